@@ -4,6 +4,8 @@
 #include <stdbool.h>
 
 #define MAX_BUF 1024
+#define COST_HINT 0x80 /* PUT flag, a uint32_t recompute cost follows the value */
+#define TTL_HINT 0x40 /* PUT flag, a uint32_t TTL in seconds follows the value (after the cost) */
 
 typedef struct args_t {
     char *hostname;
@@ -12,8 +14,10 @@ typedef struct args_t {
 
 args_t *parse_args(int argc, char **argv);
 int client_init(args_t *args);
+int open_connection(char *hostname, char *port);
+void close_connection(int clientfd);
 int handle_request(char *hostname, char *port, char *input);
-int handle_put(int clientfd, char *key, char *value);
+int handle_put(int clientfd, char *key, char *value, char *cost, char *ttl);
 int handle_get(int clientfd, char *key);
 int handle_evict(int clientfd, char *key);
 int handle_clear(int clientfd);
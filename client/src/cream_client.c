@@ -1,6 +1,11 @@
 #include "client.h"
 #include "cream.h"
 #include "csapp.h"
+#include <netinet/tcp.h>
+
+/* with keep-alive every request goes over this connection, -1 until the first one */
+static int keep_alive_fd = -1;
+static bool keep_alive;
 
 int main(int argc, char **argv) {
     args_t *args;
@@ -22,17 +27,54 @@ int main(int argc, char **argv) {
 }
 
 args_t *parse_args(int argc, char **argv) {
-    if (argc != 3) {
+    int first = 1;
+
+    if (argc == 4 && !strcmp(argv[1], "-k")) {
+        keep_alive = true;
+        first = 2;
+    } else if (argc != 3) {
         return NULL;
     }
 
     args_t *args = Malloc(sizeof(args_t));
-    args->hostname = strdup(argv[1]);
-    args->port = strdup(argv[2]);
+    args->hostname = strdup(argv[first]);
+    args->port = strdup(argv[first + 1]);
 
     return args;
 }
 
+/* a kept-alive connection the server has closed meanwhile reads EOF at once */
+int open_connection(char *hostname, char *port) {
+    char byte;
+
+    if (!keep_alive) {
+        return Open_clientfd(hostname, port);
+    }
+
+    if (keep_alive_fd != -1 &&
+        recv(keep_alive_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+        close(keep_alive_fd);
+        keep_alive_fd = -1;
+    }
+    if (keep_alive_fd == -1) {
+        int nodelay = 1;
+
+        /* a request goes out in several writes, the later ones must not wait
+           for the server's delayed ACK */
+        keep_alive_fd = Open_clientfd(hostname, port);
+        setsockopt(keep_alive_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                   sizeof(nodelay));
+    }
+
+    return keep_alive_fd;
+}
+
+void close_connection(int clientfd) {
+    if (!keep_alive) {
+        close(clientfd);
+    }
+}
+
 int client_init(args_t *args) {
     char buf[MAX_BUF + 1];
     const char *prompt = ">";
@@ -61,40 +103,44 @@ int handle_request(char *hostname, char *port, char *input) {
     char *request;
     char *key;
     char *value;
+    char *cost;
+    char *ttl;
 
     if (!(request = strtok(input, " ")))
         goto bad;
 
     key = strtok(NULL, " ");
     value = strtok(NULL, " ");
+    cost = strtok(NULL, " ");
+    ttl = strtok(NULL, " ");
 
     if (!strcmp(request, PUT_REQUEST)) {
         if (!key || !value) {
             goto bad;
         }
 
-        return handle_put(Open_clientfd(hostname, port), key, value);
+        return handle_put(open_connection(hostname, port), key, value, cost, ttl);
     } else if (!strcmp(request, GET_REQUEST)) {
         if (!key) {
             goto bad;
         }
 
-        return handle_get(Open_clientfd(hostname, port), key);
+        return handle_get(open_connection(hostname, port), key);
     } else if (!strcmp(request, EVICT_REQUEST)) {
         if (!key) {
             goto bad;
         }
 
-        return handle_evict(Open_clientfd(hostname, port), key);
+        return handle_evict(open_connection(hostname, port), key);
     } else if (!strcmp(request, CLEAR_REQUEST)) {
-        return handle_clear(Open_clientfd(hostname, port));
+        return handle_clear(open_connection(hostname, port));
     } else if (!strcmp(request, TEST_REQUEST)) {
         if (!key || !value) {
             goto bad;
         }
 
-        return handle_test(Open_clientfd(hostname, port),
-                           Open_clientfd(hostname, port), key, value);
+        return handle_test(open_connection(hostname, port),
+                           open_connection(hostname, port), key, value);
     } else if (!strcmp(request, QUIT)) {
         return -1;
     }
@@ -105,17 +151,35 @@ bad:
     return 0;
 }
 
-int handle_put(int clientfd, char *key, char *value) {
+int handle_put(int clientfd, char *key, char *value, char *cost, char *ttl) {
     request_header_t request_header = {PUT, strlen(key), strlen(value)};
     response_header_t response_header;
+    uint32_t cost_hint;
+    uint32_t ttl_hint;
+
+    /* the optional cost and TTL are sent after the value, flagged in the request code */
+    if (cost) {
+        request_header.request_code |= COST_HINT;
+        cost_hint = strtoul(cost, NULL, 10);
+    }
+    if (ttl) {
+        request_header.request_code |= TTL_HINT;
+        ttl_hint = strtoul(ttl, NULL, 10);
+    }
 
     Rio_writen(clientfd, &request_header, sizeof(request_header));
     Rio_writen(clientfd, key, request_header.key_size);
     Rio_writen(clientfd, value, request_header.value_size);
+    if (cost) {
+        Rio_writen(clientfd, &cost_hint, sizeof(cost_hint));
+    }
+    if (ttl) {
+        Rio_writen(clientfd, &ttl_hint, sizeof(ttl_hint));
+    }
 
     Rio_readn(clientfd, &response_header, sizeof(response_header));
 
-    close(clientfd);
+    close_connection(clientfd);
 
     if (response_header.response_code == OK) {
         printf("put request completed successfully.\n");
@@ -151,7 +215,7 @@ int handle_get(int clientfd, char *key) {
                response_header.response_code, response_header.value_size);
     }
 
-    close(clientfd);
+    close_connection(clientfd);
 
     return 0;
 }
@@ -165,7 +229,7 @@ int handle_evict(int clientfd, char *key) {
 
     Rio_readn(clientfd, &response_header, sizeof(response_header));
 
-    close(clientfd);
+    close_connection(clientfd);
 
     if (response_header.response_code == OK) {
         printf("evict request completed successfully.\n");
@@ -186,7 +250,7 @@ int handle_clear(int clientfd) {
 
     Rio_readn(clientfd, &response_header, sizeof(response_header));
 
-    close(clientfd);
+    close_connection(clientfd);
 
     if (response_header.response_code == OK) {
         printf("clear request completed successfully.\n");
@@ -200,7 +264,7 @@ int handle_clear(int clientfd) {
 }
 
 int handle_test(int putfd, int getfd, char *key, char *value) {
-    handle_put(putfd, key, value);
+    handle_put(putfd, key, value, NULL, NULL);
 
     char *buf;
     int actual_value_size = strlen(value);
@@ -216,14 +280,14 @@ int handle_test(int putfd, int getfd, char *key, char *value) {
         printf("get request failed with response code of %d, and key_size of "
                "%d.\n",
                response_header.response_code, response_header.value_size);
-        close(getfd);
+        close_connection(getfd);
         return 0;
     }
 
     buf = Calloc(1, response_header.value_size + 1);
     Rio_readn(getfd, buf, response_header.value_size);
 
-    close(getfd);
+    close_connection(getfd);
 
     if (actual_value_size != response_header.value_size) {
         printf("Server returned incorrect number of bytes.\n");
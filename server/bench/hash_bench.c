@@ -0,0 +1,103 @@
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> //getopt
+
+#define MAX_LEN 4096 // longest key measured, larger than MAX_KEY_SIZE on purpose
+
+#define USAGE(prog_name)                                                       \
+  do {                                                                         \
+    fprintf(stderr,                                                            \
+            "%s [-h] [-n NUM_BYTES]\n"                                         \
+            "-h\t\t\tDisplay help menu\n"                                      \
+            "-n NUM_BYTES\t\tBytes hashed per function and key size (default 268435456).\n",\
+            (prog_name));                                                      \
+  } while (0)
+
+// Measures the throughput of every hash function cream can use, for key
+// sizes from 1 byte to MAX_LEN bytes. Each hash feeds into the first byte of
+// the next key, so the calls cannot overlap and ns/hash is the latency a
+// lookup pays before it can touch the table.
+
+typedef struct bench_hash_t {
+    const char *name;
+    hash_func_f hash;
+} bench_hash_t;
+
+static const bench_hash_t hashes[] = {
+    {"jenkins", jenkins_one_at_a_time_hash},
+    {"siphash", siphash_hash},
+    {"wyhash", wyhash_hash},
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long num_bytes = 1L << 28;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                num_bytes = atol(optarg);
+                break;
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (num_bytes < 1)
+    {
+        USAGE(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    char *key = malloc(MAX_LEN);
+    for (int i = 0; i < MAX_LEN; i++)
+        key[i] = 'a' + i % 26;
+
+    printf("%8s", "key len");
+    for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+        printf(" %10s ns/hash %10s MB/s", hashes[h].name, hashes[h].name);
+    printf("\n");
+
+    for (size_t len = 1; len <= MAX_LEN; len *= 2)
+    {
+        //at least 100000 calls, so short keys are not timed on a handful.
+        long calls = num_bytes / len > 100000 ? num_bytes / len : 100000;
+
+        printf("%8zu", len);
+        for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+        {
+            uint32_t hash = 0;
+            double start = now_sec();
+
+            for (long n = 0; n < calls; n++)
+            {
+                key[0] = (char)hash;
+                hash = hashes[h].hash(MAP_KEY(key, len));
+            }
+
+            double elapsed = now_sec() - start;
+            printf(" %18.2f %15.0f", elapsed * 1e9 / calls, calls * len / elapsed / 1e6);
+        }
+        printf("\n");
+    }
+
+    free(key);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+#include "utils.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> //getopt
+
+#define KEY_LEN 16
+#define RUN_MS 500
+#define LATENCY_GETS 1000000
+
+#define USAGE(prog_name)                                                       \
+  do {                                                                         \
+    fprintf(stderr,                                                            \
+            "%s [-h] [-w] [-H] [-c] [-f HASH] [-g] [-i] [-o] [-p] [-r] [-s NUM_SHARDS] [-t MAX_THREADS] [-n NUM_ENTRIES] [-l LOAD]\n" \
+            "-h\t\t\tDisplay help menu\n"                                      \
+            "-w\t\t\tRun one writer thread next to the readers.\n"             \
+            "-H\t\t\tMap the table on 2 MB pages and fault it in up front (not with -g).\n"  \
+            "-c\t\t\tUse the swiss table layout.\n"                       \
+            "-f HASH\t\t\tHash keys with siphash (default), wyhash or jenkins.\n"\
+            "-g\t\t\tStart small and resize incrementally.\n"                 \
+            "-i\t\t\tStore the keys and values inside the table.\n"         \
+            "-o\t\t\tUse the optimistic lock-free get().\n"                   \
+            "-p\t\t\tRound the table up to a power of two slots.\n"          \
+            "-r\t\t\tUse robin hood insertion and deletion.\n"              \
+            "-s NUM_SHARDS\t\tNumber of map shards (default 1).\n"             \
+            "-t MAX_THREADS\t\tLargest reader thread count (default 64).\n"    \
+            "-n NUM_ENTRIES\t\tCapacity of the map (default 65536).\n"         \
+            "-l LOAD\t\t\tPercentage of the capacity that is filled (default 100).\n",\
+            (prog_name));                                                      \
+  } while (0)
+
+// Measures get() throughput for 1, 2, 4 ... MAX_THREADS reader threads over a
+// prefilled map. With -w a writer keeps overwriting entries during every run,
+// and its own throughput shows whether readers starve it. Probe length
+// statistics are printed after filling the map and again after replacing
+// every key once by a new one, which is what leaves tombstones behind. The
+// slowest put() while filling shows whether a growing map (-g) stalls writers.
+// The time create_map_opts() takes, the time to fill the map and the latency
+// of single-threaded random gets compare a table on huge pages (-H), faulted
+// in up front, with one that takes a page fault per 4 KB on first touch.
+
+typedef struct bench_thread_t {
+    pthread_t tid;
+    unsigned int seed;
+    unsigned long ops;
+} bench_thread_t;
+
+static hashmap_t *map;
+static char (*keys)[KEY_LEN];
+static char value[] = "value";
+static int num_entries = 65536;
+static int num_keys;
+static volatile bool running;
+
+// the benchmark owns its keys and values, nothing to free.
+static void noop_destructor(map_key_t key, map_val_t val) {
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(const char *when)
+{
+    map_stats_t stats;
+
+    get_map_stats(map, &stats);
+    printf("%s: size %u/%u, tombstones %u, probe hit avg %.2f max %u, miss avg %.2f, alarms %lu\n", when,
+        stats.size, stats.capacity, stats.tombstones, stats.avg_hit_probe, stats.max_probe,
+        stats.avg_miss_probe, stats.probe_alarms);
+}
+
+//AnonHugePages counts transparent huge pages, Private_Hugetlb the hugetlbfs pool.
+static unsigned long huge_kb(void)
+{
+    char line[128];
+    unsigned long kb, total = 0;
+    FILE *rollup = fopen("/proc/self/smaps_rollup", "r");
+
+    if (rollup == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), rollup) != NULL)
+    {
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 || sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1)
+            total += kb;
+    }
+    fclose(rollup);
+    return total;
+}
+
+static void *reader(void *arg)
+{
+    bench_thread_t *self = arg;
+
+    while (running)
+    {
+        int i = rand_r(&self->seed) % num_keys;
+        get(map, MAP_KEY(keys[i], KEY_LEN));
+        self->ops++;
+    }
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    bench_thread_t *self = arg;
+
+    while (running)
+    {
+        int i = rand_r(&self->seed) % num_keys;
+        put(map, MAP_KEY(keys[i], KEY_LEN), MAP_VAL(value, sizeof(value)), true);
+        self->ops++;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    map_opts_t opts = {.num_shards = 1};
+    hash_func_f hash_function = find_hash(NULL);
+    int max_threads = 64;
+    int load = 100;
+    bool with_writer = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hwHcf:gioprs:t:n:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                with_writer = true;
+                break;
+            case 'H':
+                opts.huge_pages = true;
+                break;
+            case 'c':
+                opts.swiss_table = true;
+                break;
+            case 'f':
+                hash_function = find_hash(optarg);
+                break;
+            case 'g':
+                opts.growable = true;
+                break;
+            case 'i':
+                opts.inline_entries = true;
+                break;
+            case 'o':
+                opts.optimistic_get = true;
+                break;
+            case 'p':
+                opts.pow2_capacity = true;
+                break;
+            case 'r':
+                opts.robin_hood = true;
+                break;
+            case 's':
+                opts.num_shards = atoi(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'n':
+                num_entries = atoi(optarg);
+                break;
+            case 'l':
+                load = atoi(optarg);
+                break;
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    num_keys = (long)num_entries * load / 100;
+    double created = now_sec();
+    if (max_threads < 1 || num_keys < 1 || load > 100 || (map = create_map_opts(num_entries,
+        hash_function, noop_destructor, opts)) == NULL)
+    {
+        USAGE(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    printf("created in %.1f ms, %lu kB on huge pages\n", (now_sec() - created) * 1e3, huge_kb());
+
+    //the readers look up keys[0 .. num_keys), the churn swaps them with the spares behind.
+    //the slowest put() shows the pause a resize costs.
+    double worst_put = 0;
+    double filled = now_sec();
+    keys = calloc(2 * num_keys, KEY_LEN);
+    for (int i = 0; i < 2 * num_keys; i++)
+    {
+        snprintf(keys[i], KEY_LEN, "key%d", i);
+        if (i < num_keys)
+        {
+            double start = now_sec();
+            put(map, MAP_KEY(keys[i], KEY_LEN), MAP_VAL(value, sizeof(value)), true);
+            if (now_sec() - start > worst_put)
+                worst_put = now_sec() - start;
+        }
+    }
+    filled = now_sec() - filled;
+    print_stats("filled");
+    printf("filled in %.1f ms, slowest put %.1f us\n", filled * 1e3, worst_put * 1e6);
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        delete(map, MAP_KEY(keys[i], KEY_LEN));
+        put(map, MAP_KEY(keys[num_keys + i], KEY_LEN), MAP_VAL(value, sizeof(value)), true);
+        memcpy(keys[i], keys[num_keys + i], KEY_LEN);
+    }
+    print_stats("churned");
+
+    //a random key per get, so nearly every probe lands on a page not in the TLB.
+    unsigned int seed = 1;
+    double latency = now_sec();
+    for (int n = 0; n < LATENCY_GETS; n++)
+        get(map, MAP_KEY(keys[rand_r(&seed) % num_keys], KEY_LEN));
+    printf("random get latency: %.1f ns\n", (now_sec() - latency) * 1e9 / LATENCY_GETS);
+
+    bench_thread_t *threads = calloc(max_threads + 1, sizeof(bench_thread_t));
+
+    printf("%8s %16s %16s %16s\n", "readers", "reads/sec", "reads/sec/thread", "writes/sec");
+    for (int n = 1; n <= max_threads; n *= 2)
+    {
+        memset(threads, 0, (max_threads + 1) * sizeof(bench_thread_t));
+        running = true;
+
+        for (int i = 0; i < n; i++)
+        {
+            threads[i].seed = i + 1;
+            pthread_create(&threads[i].tid, NULL, reader, &threads[i]);
+        }
+        if (with_writer)
+            pthread_create(&threads[n].tid, NULL, writer, &threads[n]);
+
+        double start = now_sec();
+        usleep(RUN_MS * 1000);
+        running = false;
+
+        unsigned long reads = 0;
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(threads[i].tid, NULL);
+            reads += threads[i].ops;
+        }
+        if (with_writer)
+            pthread_join(threads[n].tid, NULL);
+
+        double elapsed = now_sec() - start;
+        printf("%8d %16.0f %16.0f %16.0f\n", n, reads / elapsed, reads / elapsed / n,
+            threads[n].ops / elapsed);
+    }
+
+    invalidate_map(map);
+    free(threads);
+    free(keys);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,386 @@
+#include "cream.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h> //kill
+#include <sys/socket.h>
+#include <sys/wait.h> //waitpid
+#include <time.h>
+#include <unistd.h> //getopt, fork
+
+#define KEY_LEN 16
+#define TTL_HINT 0x40 // PUT flag of cream.c, a uint32_t TTL in seconds follows the value
+
+#define USAGE(prog_name)                                                       \
+  do {                                                                         \
+    fprintf(stderr,                                                            \
+            "%s [-h] [-a] [-r] [-c CONNECTIONS] [-d DEPTH] [-n NUM_REQUESTS] [-k NUM_KEYS] [-v VALUE_SIZE] [-S SERVER] [-w WORKERS] HOST PORT\n"\
+            "-h\t\t\tDisplay help menu\n"                                      \
+            "-a\t\t\tStart the servers of -S with -a, a listening socket per worker.\n"\
+            "-r\t\t\tOpen a new connection for every batch, which measures the accept path.\n"\
+            "-c CONNECTIONS\t\tClient threads, one kept-alive connection each (default 4).\n"\
+            "-d DEPTH\t\tGET requests sent back to back before reading the responses (default 1).\n"\
+            "-n NUM_REQUESTS\t\tGET requests per connection (default 100000).\n"\
+            "-k NUM_KEYS\t\tKeys put before the run and read by it (default 1000).\n"\
+            "-v VALUE_SIZE\t\tBytes per value (default 32).\n"                \
+            "-S SERVER\t\tStart the cream binary SERVER on PORT with each backend in turn and compare them.\n"\
+            "-w WORKERS\t\tNUM_WORKERS of the servers -S starts (default 4).\n"\
+            "HOST PORT\t\tA cream server started with -k, or the local port for -S.\n",\
+            (prog_name));                                                      \
+  } while (0)
+
+// Measures the GET throughput of a running cream server over kept-alive
+// connections. Every thread writes DEPTH requests with one send() and then
+// reads their DEPTH responses, so -d 1 is a plain request-response client
+// and larger depths show what pipelining saves. The server has to be started
+// with -k, without it every connection is closed after its first response.
+// With -S the benchmark starts the server itself, once with each backend, and
+// runs the same workload against all of them. A blocking worker keeps its
+// connection until the client closes it, so WORKERS should be at least
+// CONNECTIONS for that row to mean anything, unless -r closes every
+// connection after one batch.
+
+typedef struct bench_thread_t {
+    pthread_t tid;
+    int fd;
+    unsigned int seed;
+    long requests;
+    double batch_sec; // time from sending a batch to its last response, summed
+    bool failed;
+} bench_thread_t;
+
+static char *host, *port;
+static int depth = 1;
+static long num_requests = 100000;
+static int num_keys = 1000;
+static int value_size = 32;
+static int num_threads = 4;
+static bool reconnect;
+
+//the backends -S compares, as cream's -b takes them.
+static const char *backends[] = {"blocking", "epoll", "io_uring"};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(void)
+{
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV}, *list, *p;
+    int fd = -1, nodelay = 1;
+
+    if (getaddrinfo(host, port, &hints, &list) != 0)
+        return -1;
+    for (p = list; p != NULL; p = p->ai_next)
+    {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(list);
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+static bool send_all(int fd, char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, 0);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n <= 0)
+            return false;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return true;
+}
+
+//writes one request to buf, returns its length. a PUT never expires, the
+//keys have to outlive the server's default TTL.
+static size_t build_request(char *buf, uint8_t code, int key, const char *value, uint32_t value_len)
+{
+    request_header_t request_header = {.request_code = code, .key_size = KEY_LEN, .value_size = value_len};
+    char key_buf[KEY_LEN + 1];
+    uint32_t ttl = 0;
+    size_t len = sizeof(request_header) + KEY_LEN + value_len;
+
+    if (code == PUT)
+        request_header.request_code |= TTL_HINT;
+    snprintf(key_buf, sizeof(key_buf), "key%013d", key);
+    memcpy(buf, &request_header, sizeof(request_header));
+    memcpy(buf + sizeof(request_header), key_buf, KEY_LEN);
+    memcpy(buf + sizeof(request_header) + KEY_LEN, value, value_len);
+    if (code == PUT)
+    {
+        memcpy(buf + len, &ttl, sizeof(ttl));
+        len += sizeof(ttl);
+    }
+    return len;
+}
+
+//a miss is an answer too, a small or evicting server may not hold every key.
+static bool read_response(int fd, char *value)
+{
+    response_header_t response_header;
+
+    return recv_all(fd, &response_header, sizeof(response_header))
+        && (response_header.response_code == OK || response_header.response_code == NOT_FOUND)
+        && response_header.value_size <= MAX_VALUE_SIZE
+        && recv_all(fd, value, response_header.value_size);
+}
+
+static void *client(void *arg)
+{
+    bench_thread_t *self = arg;
+    size_t request_len = sizeof(request_header_t) + KEY_LEN;
+    char *batch = malloc(depth * request_len);
+    char value[MAX_VALUE_SIZE];
+
+    while (self->requests < num_requests && !self->failed)
+    {
+        size_t len = 0;
+        int count = num_requests - self->requests < depth ? num_requests - self->requests : depth;
+
+        for (int i = 0; i < count; i++)
+            len += build_request(batch + len, GET, rand_r(&self->seed) % num_keys, NULL, 0);
+
+        double start = now_sec();
+        if (reconnect)
+            self->failed = (self->fd = connect_to()) < 0;
+        self->failed = self->failed || !send_all(self->fd, batch, len);
+        for (int i = 0; i < count && !self->failed; i++)
+            self->failed = !read_response(self->fd, value);
+        if (reconnect && self->fd >= 0)
+        {
+            close(self->fd);
+            self->fd = -1;
+        }
+        self->batch_sec += now_sec() - start;
+        self->requests += count;
+    }
+    free(batch);
+    return NULL;
+}
+
+//puts the keys over one connection, one request at a time, then runs the
+//client threads. false if the server could not be reached or failed a request.
+static bool run(double *requests_sec, double *batch_us)
+{
+    char *value = malloc(value_size);
+    char *request = malloc(sizeof(request_header_t) + KEY_LEN + value_size + sizeof(uint32_t));
+    char response[MAX_VALUE_SIZE];
+    int fd = connect_to();
+
+    memset(value, 'v', value_size);
+    for (int i = 0; i < num_keys && fd >= 0; i++)
+    {
+        size_t len = build_request(request, PUT, i, value, value_size);
+        if (!send_all(fd, request, len) || !read_response(fd, response))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    free(request);
+    free(value);
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not put the keys into %s:%s\n", host, port);
+        return false;
+    }
+    close(fd);
+
+    bench_thread_t *threads = calloc(num_threads, sizeof(bench_thread_t));
+    for (int i = 0; i < num_threads; i++)
+    {
+        threads[i].seed = i + 1;
+        threads[i].fd = -1;
+        if (!reconnect && (threads[i].fd = connect_to()) < 0)
+        {
+            fprintf(stderr, "could not connect to %s:%s\n", host, port);
+            while (i-- > 0)
+                if (threads[i].fd >= 0)
+                    close(threads[i].fd);
+            free(threads);
+            return false;
+        }
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&threads[i].tid, NULL, client, &threads[i]);
+
+    long requests = 0, batches = 0;
+    double batch_sec = 0;
+    bool failed = false;
+    for (int i = 0; i < num_threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        if (threads[i].fd >= 0)
+            close(threads[i].fd);
+        requests += threads[i].requests;
+        batches += (threads[i].requests + depth - 1) / depth;
+        batch_sec += threads[i].batch_sec;
+        failed |= threads[i].failed;
+    }
+    double elapsed = now_sec() - start;
+
+    *requests_sec = requests / elapsed;
+    *batch_us = batch_sec / batches * 1e6;
+    if (failed)
+        fprintf(stderr, "a connection failed, is the server running with -k?\n");
+    free(threads);
+    return !failed;
+}
+
+//starts server with the backend and waits up to 5 seconds for it to accept.
+//-k makes the blocking workers keep their connections, the other backends
+//always do.
+static pid_t start_server(const char *server, const char *backend, int num_workers, bool reuse_port)
+{
+    char workers[16], entries[16];
+    pid_t pid;
+
+    snprintf(workers, sizeof(workers), "%d", num_workers);
+    snprintf(entries, sizeof(entries), "%d", 2 * num_keys);
+    if ((pid = fork()) == 0)
+    {
+        if (reuse_port)
+            execl(server, server, "-a", "-k", "-b", backend, workers, port, entries, (char *)NULL);
+        else
+            execl(server, server, "-k", "-b", backend, workers, port, entries, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    for (int tries = 0; pid > 0 && tries < 500; tries++)
+    {
+        int fd = connect_to();
+
+        if (fd >= 0)
+        {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        usleep(10000);
+    }
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *server = NULL;
+    int num_workers = 4;
+    bool reuse_port = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "harc:d:n:k:v:S:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                reuse_port = true;
+                break;
+            case 'r':
+                reconnect = true;
+                break;
+            case 'c':
+                num_threads = atoi(optarg);
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'n':
+                num_requests = atol(optarg);
+                break;
+            case 'k':
+                num_keys = atoi(optarg);
+                break;
+            case 'v':
+                value_size = atoi(optarg);
+                break;
+            case 'S':
+                server = optarg;
+                break;
+            case 'w':
+                num_workers = atoi(optarg);
+                break;
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind != 2 || num_threads < 1 || depth < 1 || num_requests < 1 || num_keys < 1
+        || value_size < MIN_VALUE_SIZE || value_size > MAX_VALUE_SIZE || num_workers < 1)
+    {
+        USAGE(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    host = argv[optind];
+    port = argv[optind + 1];
+
+    double requests_sec, batch_us;
+    bool failed = false;
+
+    printf("%10s %12s %8s %16s %16s\n", "backend", "connections", "depth", "requests/sec", "us/batch");
+    if (server == NULL)
+    {
+        failed = !run(&requests_sec, &batch_us);
+        printf("%10s %12d %8d %16.0f %16.1f\n", "-", num_threads, depth, requests_sec, batch_us);
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        pid_t pid = start_server(server, backends[i], num_workers, reuse_port);
+
+        if (pid < 0)
+        {
+            fprintf(stderr, "%s did not start with -b %s on port %s\n", server, backends[i], port);
+            failed = true;
+            continue;
+        }
+        if (run(&requests_sec, &batch_us))
+            printf("%10s %12d %8d %16.0f %16.1f\n", backends[i], num_threads, depth, requests_sec, batch_us);
+        else
+            failed = true;
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
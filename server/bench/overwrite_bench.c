@@ -0,0 +1,212 @@
+#include "utils.h"
+#include "epoch.h"
+#include "refbuf.h"
+#include "slab.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> //getopt, sysconf
+
+#define KEY_LEN 16
+#define MAX_CLASSES 128
+
+#define USAGE(prog_name)                                                       \
+  do {                                                                         \
+    fprintf(stderr,                                                            \
+            "%s [-h] [-w WRITERS] [-r READERS] [-n NUM_KEYS] [-o NUM_OPS] [-R ROUNDS]\n"\
+            "-h\t\t\tDisplay help menu\n"                                      \
+            "-w WRITERS\t\tThreads overwriting keys (default 4).\n"           \
+            "-r READERS\t\tThreads reading keys inside epoch sections (default 4).\n"\
+            "-n NUM_KEYS\t\tKeys in the map, all of them stay present (default 10000).\n"\
+            "-o NUM_OPS\t\tOverwrites per writer and round (default 200000).\n"\
+            "-R ROUNDS\t\tRounds to run (default 10).\n",                      \
+            (prog_name));                                                      \
+  } while (0)
+
+// Overwrites a fixed set of keys over and over, with values of 1 byte to 4 KB
+// allocated like cream allocates them, while readers keep getting the keys
+// the way a worker does. After every round it prints the process RSS next to
+// the map's, the slab allocator's and the epoch reclamation's own accounts.
+// Without reclamation on overwrite, every put leaks its value and the
+// caller's copy of the key, and all of them grow without bound.
+
+typedef struct bench_thread_t {
+    pthread_t tid;
+    unsigned int seed;
+    long ops;
+    long sum;               // of the bytes readers touched, keeps the reads alive
+} bench_thread_t;
+
+static hashmap_t *map;
+static int num_keys = 10000;
+static long num_ops = 200000;
+static char (*keys)[KEY_LEN];
+static bool reading;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void slab_destructor(map_key_t key, map_val_t val)
+{
+    slab_free(key.key_base, key.key_len);
+    refbuf_release(val.val_base, val.val_len);
+}
+
+//a put() the way cream does it: the map owns fresh copies of both.
+static void put_copy(const char *key, size_t val_len, char fill)
+{
+    char *key_copy = slab_alloc(KEY_LEN);
+    char *val_copy = refbuf_alloc(val_len);
+
+    memcpy(key_copy, key, KEY_LEN);
+    memset(val_copy, fill, val_len);
+    put(map, MAP_KEY(key_copy, KEY_LEN), MAP_VAL(val_copy, val_len), true);
+}
+
+static void *writer(void *arg)
+{
+    bench_thread_t *self = arg;
+
+    for (long n = 0; n < num_ops; n++)
+    {
+        int i = rand_r(&self->seed) % num_keys;
+        put_copy(keys[i], 1 + rand_r(&self->seed) % 4096, 'a' + n % 26);
+        self->ops++;
+    }
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    bench_thread_t *self = arg;
+
+    while (__atomic_load_n(&reading, __ATOMIC_RELAXED))
+    {
+        int i = rand_r(&self->seed) % num_keys;
+
+        epoch_enter();
+        map_val_t val = get(map, MAP_KEY(keys[i], KEY_LEN));
+        //a freed value would be refilled by another put, or crash under ASan.
+        if (val.val_base != NULL)
+            self->sum += ((char *)val.val_base)[val.val_len - 1];
+        epoch_exit();
+        self->ops++;
+    }
+    return NULL;
+}
+
+static double rss_mb(void)
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%*d %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_writers = 4, num_readers = 4, rounds = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hw:r:n:o:R:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                num_writers = atoi(optarg);
+                break;
+            case 'r':
+                num_readers = atoi(optarg);
+                break;
+            case 'n':
+                num_keys = atoi(optarg);
+                break;
+            case 'o':
+                num_ops = atol(optarg);
+                break;
+            case 'R':
+                rounds = atoi(optarg);
+                break;
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (num_writers < 1 || num_readers < 0 || num_keys < 1 || num_ops < 1 || rounds < 1
+        || (map = create_map(num_keys, jenkins_one_at_a_time_hash, slab_destructor)) == NULL)
+    {
+        USAGE(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    keys = calloc(num_keys, KEY_LEN);
+    for (int i = 0; i < num_keys; i++)
+    {
+        snprintf(keys[i], KEY_LEN, "key%d", i);
+        put_copy(keys[i], 1 + i % 4096, 'a');
+    }
+
+    bench_thread_t *writers = calloc(num_writers, sizeof(bench_thread_t));
+    bench_thread_t *readers = calloc(num_readers, sizeof(bench_thread_t));
+
+    printf("%6s %12s %10s %12s %12s %10s %12s\n", "round", "puts/sec", "rss MB", "map MB",
+        "slab MB", "pending", "reclaimed");
+    for (int round = 1; round <= rounds; round++)
+    {
+        double start = now_sec();
+
+        __atomic_store_n(&reading, true, __ATOMIC_RELAXED);
+        for (int i = 0; i < num_readers; i++)
+        {
+            readers[i].seed = round * 1000 + i;
+            pthread_create(&readers[i].tid, NULL, reader, &readers[i]);
+        }
+        for (int i = 0; i < num_writers; i++)
+        {
+            writers[i].seed = round * 1000 + num_readers + i;
+            writers[i].ops = 0;
+            pthread_create(&writers[i].tid, NULL, writer, &writers[i]);
+        }
+        for (int i = 0; i < num_writers; i++)
+            pthread_join(writers[i].tid, NULL);
+        __atomic_store_n(&reading, false, __ATOMIC_RELAXED);
+        for (int i = 0; i < num_readers; i++)
+            pthread_join(readers[i].tid, NULL);
+
+        double elapsed = now_sec() - start;
+        map_stats_t map_stats;
+        epoch_stats_t epoch_stats;
+        slab_stats_t slab_stats[MAX_CLASSES];
+        int num_stats = slab_get_stats(slab_stats, MAX_CLASSES);
+        double slab_mb = 0;
+
+        get_map_stats(map, &map_stats);
+        epoch_get_stats(&epoch_stats);
+        for (int i = 0; i < num_stats; i++)
+            slab_mb += slab_stats[i].pages * (double)SLAB_PAGE_SIZE / (1 << 20);
+
+        printf("%6d %12.0f %10.1f %12.1f %12.1f %10lu %12lu\n", round, num_writers * num_ops / elapsed,
+            rss_mb(), map_stats.bytes / (double)(1 << 20), slab_mb,
+            epoch_stats.retired - epoch_stats.reclaimed, epoch_stats.reclaimed);
+    }
+
+    free(writers);
+    free(readers);
+    free(keys);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#include "slab.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> //getopt
+
+#define LIVE_SLOTS 4096 // allocations every thread keeps alive at once
+#define MAX_CLASSES 128
+
+#define USAGE(prog_name)                                                       \
+  do {                                                                         \
+    fprintf(stderr,                                                            \
+            "%s [-h] [-m] [-t MAX_THREADS] [-n NUM_OPS]\n"                     \
+            "-h\t\t\tDisplay help menu\n"                                      \
+            "-m\t\t\tUse malloc()/free() instead of the slab allocator.\n"     \
+            "-t MAX_THREADS\t\tLargest thread count (default 8).\n"            \
+            "-n NUM_OPS\t\tAllocations per thread and run (default 1000000).\n",\
+            (prog_name));                                                      \
+  } while (0)
+
+// Measures allocation throughput for 1, 2, 4 ... MAX_THREADS threads. Every
+// thread replaces random entries of its own set of live allocations, with
+// sizes spread like cream's keys and values: mostly small, some up to 4 KB.
+// After the runs the per-class statistics of the slab allocator are printed.
+
+typedef struct bench_thread_t {
+    pthread_t tid;
+    unsigned int seed;
+} bench_thread_t;
+
+static bool use_malloc;
+static long num_ops = 1000000;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t random_size(unsigned int *seed)
+{
+    int r = rand_r(seed) % 100;
+
+    if (r < 60)
+        return 1 + rand_r(seed) % 32;
+    else if (r < 90)
+        return 1 + rand_r(seed) % 512;
+    return 1 + rand_r(seed) % 4096;
+}
+
+static void *worker(void *arg)
+{
+    bench_thread_t *self = arg;
+    void *ptrs[LIVE_SLOTS] = {NULL};
+    size_t sizes[LIVE_SLOTS] = {0};
+
+    for (long n = 0; n < num_ops; n++)
+    {
+        int i = rand_r(&self->seed) % LIVE_SLOTS;
+
+        if (use_malloc)
+            free(ptrs[i]);
+        else
+            slab_free(ptrs[i], sizes[i]);
+
+        sizes[i] = random_size(&self->seed);
+        ptrs[i] = use_malloc ? malloc(sizes[i]) : slab_alloc(sizes[i]);
+        memset(ptrs[i], 0, 1);
+    }
+
+    for (int i = 0; i < LIVE_SLOTS; i++)
+    {
+        if (use_malloc)
+            free(ptrs[i]);
+        else
+            slab_free(ptrs[i], sizes[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hmt:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                use_malloc = true;
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'n':
+                num_ops = atol(optarg);
+                break;
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (max_threads < 1 || num_ops < 1)
+    {
+        USAGE(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_thread_t *threads = calloc(max_threads, sizeof(bench_thread_t));
+
+    printf("%8s %16s %16s\n", "threads", "ops/sec", "ops/sec/thread");
+    for (int n = 1; n <= max_threads; n *= 2)
+    {
+        double start = now_sec();
+
+        for (int i = 0; i < n; i++)
+        {
+            threads[i].seed = i + 1;
+            pthread_create(&threads[i].tid, NULL, worker, &threads[i]);
+        }
+        for (int i = 0; i < n; i++)
+            pthread_join(threads[i].tid, NULL);
+
+        double elapsed = now_sec() - start;
+        printf("%8d %16.0f %16.0f\n", n, n * num_ops / elapsed, num_ops / elapsed);
+    }
+
+    if (!use_malloc)
+    {
+        slab_stats_t stats[MAX_CLASSES];
+        int num_stats = slab_get_stats(stats, MAX_CLASSES);
+
+        printf("\n%10s %8s %10s %10s %10s %12s %12s\n", "chunk", "pages", "chunks", "free",
+            "cached", "allocs", "frees");
+        for (int i = 0; i < num_stats; i++)
+        {
+            if (stats[i].allocs == 0 && stats[i].frees == 0)
+                continue;
+            if (stats[i].chunk_size == 0)
+                printf("%10s", "large");
+            else
+                printf("%10zu", stats[i].chunk_size);
+            printf(" %8lu %10lu %10lu %10lu %12lu %12lu\n", stats[i].pages, stats[i].chunks,
+                stats[i].free_chunks, stats[i].cached_chunks, stats[i].allocs, stats[i].frees);
+        }
+    }
+
+    free(threads);
+    return EXIT_SUCCESS;
+}
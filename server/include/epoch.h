@@ -0,0 +1,55 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "utils.h"
+
+/*
+ * Epoch based reclamation for entries that lock-free readers may still be
+ * looking at. A thread reading map memory without the map lock brackets the
+ * read with epoch_enter()/epoch_exit(), and writers hand removed entries to
+ * epoch_retire() instead of destroying them. A retired entry is destroyed only
+ * once every thread that could have seen it has left its critical section.
+ */
+
+typedef struct epoch_stats_t {
+    uint64_t retired;   // entries handed to epoch_retire() or epoch_free()
+    uint64_t reclaimed; // of those, destroyed already
+} epoch_stats_t;
+
+/*
+ * Enter a read-side critical section on the calling thread.
+ * Calls may be nested, only the outermost pair has an effect.
+ */
+void epoch_enter(void);
+
+/*
+ * Leave the read-side critical section entered by epoch_enter().
+ */
+void epoch_exit(void);
+
+/*
+ * Defer destroy_function(key, val) until no reader can still reference the
+ * entry. Safe to call with or without holding any map lock.
+ *
+ * @param destroy_function The function used to destroy the entry.
+ * @param key The key of the removed entry.
+ * @param val The value of the removed entry.
+ */
+void epoch_retire(destructor_f destroy_function, map_key_t key, map_val_t val);
+
+/*
+ * Defer free(ptr) until no reader can still reference it.
+ *
+ * @param ptr The memory to free.
+ */
+void epoch_free(void *ptr);
+
+/*
+ * Count the retired entries and how many of them have been destroyed, the
+ * difference is the memory still waiting for readers to move on.
+ *
+ * @param stats Filled with the counts since the process started.
+ */
+void epoch_get_stats(epoch_stats_t *stats);
+
+#endif
@@ -26,25 +26,115 @@ typedef struct map_val_t {
 typedef uint32_t (*hash_func_f)(map_key_t);
 typedef void (*destructor_f)(map_key_t, map_val_t);
 
+#define INLINE_KEY_SIZE 24
+#define INLINE_VAL_SIZE 64
+
+// the neighbours of an entry on one of the eviction policy's lists, by index.
+typedef struct lru_link_t {
+    int32_t prev; // more recently used neighbour, -1 at the head
+    int32_t next; // less recently used neighbour, -1 at the tail
+} lru_link_t;
+
 typedef struct map_node_t {
     map_key_t key;
     map_val_t val;
     bool tombstone;
-    int accessIdx; //for LRU cash
+    uint32_t hash; // hash_function(key), compared before the key bytes
+    lru_link_t link;
+    uint8_t list; // the policy list the node is on
+    bool referenced; // hit since the clock hand last passed, CLOCK only
+    uint32_t cost; // recompute cost given to put_ext()
+    uint32_t freq; // requests since the entry was inserted, GDSF only
+    int32_t heap_pos; // GDSF only
+    double priority; // GDSF only
+    uint64_t expires; // CLOCK_MONOTONIC milliseconds the entry expires at, 0 for never
 } map_node_t;
 
+// per-entry settings for put_ext().
+typedef struct map_put_opts_t {
+    uint32_t cost; // cost of recomputing the value, put() uses 1
+    uint32_t ttl_ms; // milliseconds until the entry expires, 0 for never
+} map_put_opts_t;
+
+// a recently evicted key, remembered by its hash only (ARC and 2Q).
+typedef struct map_ghost_t {
+    lru_link_t link;
+    uint32_t hash;
+    uint8_t list; // the ghost list the entry is on
+} map_ghost_t;
+
+typedef struct lru_list_t {
+    int32_t head; // most recently used entry
+    int32_t tail; // least recently used entry
+    uint32_t size;
+    bool ghost; // links map_ghost_t entries instead of nodes
+} lru_list_t;
+
+struct hashmap_t;
+
+// An eviction policy. on_hit is called by get() with only the read lock held,
+// every other hook with the map lock held for writing. choose_victim is called
+// when a new key does not fit, it gets the new key's hash and returns a live
+// entry that it has already taken off its lists. on_move is called after a
+// deletion moved a live entry to another slot.
+typedef struct map_policy_t {
+    const char *name;
+    bool (*init)(struct hashmap_t *self); // allocates the policy's state, false without memory, may be NULL
+    void (*on_insert)(struct hashmap_t *self, int idx);
+    void (*on_hit)(struct hashmap_t *self, int idx);
+    void (*on_delete)(struct hashmap_t *self, int idx);
+    void (*on_move)(struct hashmap_t *self, int from, int to);
+    int (*choose_victim)(struct hashmap_t *self, uint32_t hash);
+} map_policy_t;
+
+typedef struct map_opts_t {
+    uint32_t num_shards; // independent sub-tables, each with its own locks and size
+    bool optimistic_get; // ignored, LRU get() has to move the entry in the LRU list
+    bool robin_hood; // ignored, the LRU map always deletes by backward shift
+    bool growable; // ignored, the LRU map evicts at a fixed capacity
+    bool swiss_table; // ignored, the LRU map probes the nodes directly
+    bool inline_entries; // ignored, the LRU map owns every key and value
+    const char *eviction; // "lru" (also for NULL), "clock", "tinylfu", "arc", "2q" or "gdsf"
+    uint64_t max_bytes; // budget for the stored keys and values, 0 for none
+    bool pow2_capacity; // ignored, the capacity is the number of entries (a power of two is masked anyway)
+    bool huge_pages; // map the nodes on 2 MB pages, faulted in before create_map returns
+} map_opts_t;
+
 typedef struct hashmap_t {
-    uint32_t capacity;
+    uint32_t capacity; // slots in nodes
     uint32_t size;
+    uint32_t max_entries; // entries the map holds before put() evicts
+    uint64_t bytes; // key_len + val_len of the stored entries
+    uint64_t max_bytes; // 0 if only the capacity limits the map
     map_node_t *nodes;
+    bool huge_pages; // nodes come from huge_alloc()
     hash_func_f hash_function;
     destructor_f destroy_function;
-    int num_readers;
-    pthread_mutex_t write_lock;
-    pthread_mutex_t fields_lock;
+    pthread_rwlock_t lock; // writer-preferring readers/writers lock
+    pthread_mutex_t fields_lock; // guards the LRU list updated by readers
     bool invalid;
-    int accessCnt; //for LRU cash
-} hashmap_t;
+    bool inline_entries; // always false, callers check it before lending buffers to put()
+    uint64_t probe_alarms; // lookups that probed PROBE_ALARM slots or more, updated atomically
+    uint32_t num_shards;
+    struct hashmap_t *shards;
+    const map_policy_t *policy;
+    lru_list_t lists[2]; // live entries, what each list means is up to the policy
+    lru_list_t ghosts[2]; // evicted keys, ARC and 2Q only
+    map_ghost_t *ghost_nodes;
+    uint32_t ghost_cap;
+    int32_t ghost_free; // unused ghosts, chained through link.next
+    int32_t *ghost_index; // open addressing set of the ghosts by hash
+    uint32_t ghost_mask;
+    uint32_t target; // ARC: target size of lists[0], TinyLFU: window size, 2Q: size of A1in
+    int32_t admit_list; // ARC: list chosen for the key being inserted, -1 if undecided
+    uint32_t clock_hand; // next slot the clock looks at
+    uint8_t *sketch; // TinyLFU count-min sketch, SKETCH_DEPTH rows of saturating counters
+    uint32_t sketch_shift; // 32 - log2 of the row width
+    uint64_t sketch_ops; // increments since the counters were last halved
+    int32_t *heap; // GDSF min-heap of the nodes by priority
+    uint32_t heap_size;
+    double inflation; // GDSF: priority of the last victim, added to every new priority
+} __attribute__((aligned(64))) hashmap_t;
 
 /* **DO NOT** modify the function prototypes below */
 
@@ -59,6 +149,21 @@ typedef struct hashmap_t {
  */
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function);
 
+/*
+ * Create a new hash map split into opts.num_shards independent sub-tables.
+ * Each shard has its own locks and size, and a key is routed to its shard by
+ * the high bits of its hash. A shard count of 0 or 1 behaves like create_map().
+ *
+ * @param capacity The number of elements the map can hold.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @param opts Tuning options for the map.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_map_opts(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function,
+                           map_opts_t opts);
+
 /*
  * Insert a new key/value pair into the map.
  * If the key already exists, the corresponding value is overwritten.
@@ -74,6 +179,21 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
  */
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 
+/*
+ * Insert a new key/value pair like put(), with a time to live and the cost of
+ * recomputing the value. Once the time to live has passed, get() no longer
+ * finds the entry and delete_expired() removes it. The gdsf policy keeps an
+ * entry longer the higher its cost per byte is, the other policies ignore it.
+ *
+ * @param self The hash map to use
+ * @param key The key to insert
+ * @param val The value to insert
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @param opts The time to live and the cost of the entry.
+ * @return true if the insertion was sucessful, false otherwise.
+ */
+bool put_ext(hashmap_t *self, map_key_t key, map_val_t val, bool force, map_put_opts_t opts);
+
 /*
  * Retrieve the value associated with a key.
  *
@@ -93,6 +213,16 @@ map_val_t get(hashmap_t *self, map_key_t key);
  */
 map_node_t delete(hashmap_t *self, map_key_t key);
 
+/*
+ * Remove the entry associated with a key if its time to live has passed.
+ *
+ * @param self The hash map to use
+ * @param key The key to remove.
+ * @return The removed entry like delete(), with a key length of 0 if the key
+ *         is not found or has not expired yet.
+ */
+map_node_t delete_expired(hashmap_t *self, map_key_t key);
+
 /*
  * Clears and destroys all entries in the map.
  *
@@ -0,0 +1,81 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Key hash functions the server can choose from. jenkins_one_at_a_time_hash()
+ * (utils.h) mixes one byte per step, wyhash_hash() reads the key eight bytes
+ * at a time and mixes whole words with a 64x64->128 bit multiply, so its cost
+ * barely grows with the key until keys get long.
+ *
+ * Keys come from clients, and anyone who can compute the hash can send a set
+ * of keys that all land in one probe chain. siphash_hash() is a keyed hash
+ * built against exactly that: without the 128 bit process key, which
+ * hash_seed_random() draws at startup, colliding keys cannot be found faster
+ * than by trying. wyhash_hash() is seeded with the same key but keeps its
+ * public multiplication constants, so some collisions do not depend on the
+ * seed. jenkins is not keyed at all.
+ */
+
+/*
+ * Draw a new process key for siphash_hash() and wyhash_hash() from the
+ * kernel's random number generator. Maps hash with the key that is current at
+ * each call, so this must happen before the first map is created.
+ *
+ * @return true on success, false if no random bytes could be read.
+ */
+bool hash_seed_random(void);
+
+/*
+ * Set the process key explicitly, for reproducible runs. Until either
+ * function is called the key is zero.
+ *
+ * @param key The two 64 bit halves of the key.
+ */
+void hash_seed(const uint64_t key[2]);
+
+/*
+ * SipHash-1-3 of a byte stream.
+ *
+ * @param data The bytes to hash.
+ * @param len The number of bytes.
+ * @param key The 128 bit key.
+ * @return The 64 bit hash.
+ */
+uint64_t siphash(const void *data, size_t len, const uint64_t key[2]);
+
+/*
+ * Computes the hash of a key with siphash() under the process key, folded
+ * to 32 bits.
+ */
+uint32_t siphash_hash(map_key_t map_key);
+
+/*
+ * wyhash (final version 4) of a byte stream.
+ *
+ * @param key The bytes to hash.
+ * @param len The number of bytes.
+ * @param seed Selects one of 2^64 hash functions.
+ * @return The 64 bit hash.
+ */
+uint64_t wyhash(const void *key, size_t len, uint64_t seed);
+
+/*
+ * Computes the hash of a key with wyhash(), seeded with the process key and
+ * folded to 32 bits.
+ */
+uint32_t wyhash_hash(map_key_t map_key);
+
+/*
+ * Look up a hash function by name.
+ *
+ * @param name "siphash", "wyhash" or "jenkins", NULL picks siphash.
+ * @return The hash function, or NULL if the name is unknown.
+ */
+hash_func_f find_hash(const char *name);
+
+#endif
@@ -25,23 +25,78 @@ typedef struct map_val_t {
 typedef uint32_t (*hash_func_f)(map_key_t);
 typedef void (*destructor_f)(map_key_t, map_val_t);
 
+#define INLINE_KEY_SIZE 24 // largest key an inline map copies into its table
+#define INLINE_VAL_SIZE 64 // largest value an inline map copies into its table
+
 typedef struct map_node_t {
     map_key_t key;
     map_val_t val;
     bool tombstone;
+    uint32_t hash; // hash_function(key), compared before the key bytes
+    uint32_t dist; // distance from the home slot, robin hood mode only
+    uint64_t expires; // CLOCK_MONOTONIC milliseconds the entry expires at, 0 for never
 } map_node_t;
 
-typedef struct hashmap_t {
+// per-entry settings for put_ext().
+typedef struct map_put_opts_t {
+    uint32_t cost; // cost of recomputing the value, put() uses 1
+    uint32_t ttl_ms; // milliseconds until the entry expires, 0 for never
+} map_put_opts_t;
+
+typedef struct map_opts_t {
+    uint32_t num_shards; // independent sub-tables, each with its own locks and size
+    bool optimistic_get; // lock-free get() validated by a per-shard sequence counter
+    bool robin_hood; // robin hood insertion with backward-shift deletion, no tombstones
+    bool growable; // start small and resize incrementally with the number of entries
+    bool swiss_table; // probe 16 one byte hash tags at a time with SSE2, overrides robin_hood
+    bool inline_entries; // copy small keys and values into the table instead of owning them
+    const char *eviction; // must be NULL, a full map replaces an entry next to the key's home slot
+    uint64_t max_bytes; // must be 0, only the capacity limits the map
+    bool pow2_capacity; // round the slots up to a power of two, indexed with a mask instead of a modulo
+    bool huge_pages; // map the node and inline arrays on 2 MB pages, faulted in before create_map returns, not with growable
+} map_opts_t;
+
+typedef struct map_stats_t {
     uint32_t capacity;
     uint32_t size;
+    uint32_t tombstones;
+    // probe lengths count slots, or groups of 16 slots in swiss table mode
+    uint32_t max_probe;    // slots visited by the longest successful lookup
+    double avg_hit_probe;  // slots visited by a successful lookup
+    double avg_miss_probe; // slots visited by an unsuccessful lookup, over all home slots
+    uint64_t probe_alarms; // lookups that visited PROBE_ALARM slots or more since the map was created
+    uint64_t bytes; // key and value bytes of the stored entries
+} map_stats_t;
+
+typedef struct hashmap_t {
+    uint32_t capacity; // slots in nodes
+    uint32_t size;
     map_node_t *nodes;
+    uint8_t *ctrl; // per slot hash tag or empty/deleted, swiss table mode only
+    struct map_inline_t *inline_data; // per slot small key and value bytes, inline mode only
+    uint32_t max_entries; // entries the map holds before put() needs force
+    bool growable;
+    map_node_t *old_nodes; // table being migrated into nodes while resizing
+    uint8_t *old_ctrl;
+    struct map_inline_t *old_inline_data;
+    uint32_t old_capacity;
+    uint32_t migrate_idx; // next old slot to migrate
     hash_func_f hash_function;
     destructor_f destroy_function;
-    int num_readers;
-    pthread_mutex_t write_lock;
-    pthread_mutex_t fields_lock;
+    pthread_rwlock_t lock; // writer-preferring readers/writers lock
     bool invalid;
-} hashmap_t;
+    uint32_t seq; // odd while a writer modifies the nodes
+    bool optimistic_get;
+    bool robin_hood;
+    bool swiss_table;
+    bool inline_entries;
+    bool pow2_capacity;
+    bool huge_pages; // nodes and inline_data come from huge_alloc()
+    uint64_t probe_alarms; // lookups that probed PROBE_ALARM slots or more, updated atomically
+    uint64_t bytes; // key and value bytes of the stored entries
+    uint32_t num_shards;
+    struct hashmap_t *shards;
+} __attribute__((aligned(64))) hashmap_t;
 
 /*
  * Create a new hash map.
@@ -54,6 +109,21 @@ typedef struct hashmap_t {
  */
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function);
 
+/*
+ * Create a new hash map split into opts.num_shards independent sub-tables.
+ * Each shard has its own locks and size, and a key is routed to its shard by
+ * the high bits of its hash. A shard count of 0 or 1 behaves like create_map().
+ *
+ * @param capacity The number of elements the map can hold.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements
+ *                         when the map is destroyed.
+ * @param opts Tuning options for the map.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_map_opts(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function,
+                           map_opts_t opts);
+
 /*
  * Insert a new key/value pair into the map.
  * If the key already exists, the corresponding value is overwritten.
@@ -61,6 +131,11 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
  * If the map is full and force is true, the entry at the index computed by
  * get_index() is overwritten.
  *
+ * An inline map copies keys up to INLINE_KEY_SIZE and values up to
+ * INLINE_VAL_SIZE bytes into its table. The caller keeps the buffers of those
+ * parts, and only the larger parts are owned and destroyed by the map:
+ * destroy_function is handed a NULL base for the parts stored inline.
+ *
  * @param self The hash map to use
  * @param key The key to insert
  * @param val The value to insert
@@ -69,9 +144,28 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
  */
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 
+/*
+ * Insert a new key/value pair like put(), with a time to live. Once it has
+ * passed, get() no longer finds the entry and delete_expired() removes it.
+ * The cost only matters to a cost-aware eviction policy, this map ignores it.
+ *
+ * @param self The hash map to use
+ * @param key The key to insert
+ * @param val The value to insert
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @param opts The time to live and the cost of the entry.
+ * @return true if the insertion was sucessful, false otherwise.
+ */
+bool put_ext(hashmap_t *self, map_key_t key, map_val_t val, bool force, map_put_opts_t opts);
+
 /*
  * Retrieve the value associated with a key.
  *
+ * The returned value may be retired by a concurrent writer at any time, so
+ * callers that dereference it must do so inside epoch_enter()/epoch_exit().
+ * A value stored inline is returned in a per-thread buffer that the next
+ * get() on the same thread overwrites.
+ *
  * @param self The hash map to use
  * @param key The key to search for
  * @return The corresponding value, or a map_val_t instance with a null
@@ -81,13 +175,25 @@ map_val_t get(hashmap_t *self, map_key_t key);
 
 /*
  * Remove the entry associated with a key.
+ * Parts of the entry stored inline come back with a NULL base and their length.
  *
  * @param self The hash map to use
  * @param key The key to remove.
- * @return The removed map_node_t instance.
+ * @return The removed map_node_t instance, with a key length of 0 if the key is
+ *         not found.
  */
 map_node_t delete(hashmap_t *self, map_key_t key);
 
+/*
+ * Remove the entry associated with a key if its time to live has passed.
+ *
+ * @param self The hash map to use
+ * @param key The key to remove.
+ * @return The removed entry like delete(), with a key length of 0 if the key
+ *         is not found or has not expired yet.
+ */
+map_node_t delete_expired(hashmap_t *self, map_key_t key);
+
 /*
  * Clears and destroys all entries in the map.
  *
@@ -105,4 +211,14 @@ bool clear_map(hashmap_t *self);
  */
 bool invalidate_map(hashmap_t *self);
 
+/*
+ * Compute probe length statistics over every entry in the map.
+ * This walks the whole table and is meant for diagnostics, not the hot path.
+ *
+ * @param self The hash map to inspect.
+ * @param stats Filled with the statistics of all shards combined.
+ * @return true if the statistics were computed.
+ */
+bool get_map_stats(hashmap_t *self, map_stats_t *stats);
+
 #endif
@@ -0,0 +1,36 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stddef.h>
+
+/*
+ * Large zeroed arrays backed by 2 MB pages, for the node tables of big maps.
+ * A table of tens of millions of slots spread over 4 KB pages costs a page
+ * fault the first time each page is touched, stretched over the first minutes
+ * of traffic, and a random probe misses the TLB almost every time.
+ *
+ * huge_alloc() maps the array from the hugetlbfs pool when one is reserved
+ * (vm.nr_hugepages), and otherwise asks for transparent huge pages on a 2 MB
+ * aligned mapping. Either way every page is faulted in before it returns,
+ * split over one thread per online CPU, so the cost is paid once at startup.
+ */
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Map len zeroed bytes on huge pages and fault all of them in.
+ *
+ * @param len The number of bytes, rounded up to a multiple of HUGE_PAGE_SIZE.
+ * @return The array, aligned to HUGE_PAGE_SIZE, or NULL if no memory is left.
+ */
+void *huge_alloc(size_t len);
+
+/*
+ * Unmap an array returned by huge_alloc().
+ *
+ * @param ptr The array, NULL is ignored.
+ * @param len The length it was allocated with.
+ */
+void huge_free(void *ptr, size_t len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef REFBUF_H
+#define REFBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Reference counted buffers for the values the server stores. The count sits
+ * in a small header in front of the bytes, so a buffer is handed around as a
+ * plain pointer to its bytes and the map never knows the difference.
+ *
+ * The map holds one reference from put() until its destructor runs. A worker
+ * answering a GET takes another one while its epoch_enter() section still
+ * guarantees the buffer is alive, leaves the section, and writes the bytes
+ * straight to the socket. A slow client then pins only the value it is being
+ * sent, instead of holding back the reclamation of every retired entry.
+ */
+
+/*
+ * Allocate a buffer of len bytes with a reference count of 1.
+ *
+ * @param len The number of bytes.
+ * @return The bytes of the buffer, or NULL if no memory is left.
+ */
+void *refbuf_alloc(size_t len);
+
+/*
+ * Take another reference to a buffer. The caller must know the buffer is
+ * still alive, by holding a reference or by being inside an epoch section
+ * that started before the map dropped its reference.
+ *
+ * @param buf The bytes of the buffer.
+ */
+void refbuf_acquire(void *buf);
+
+/*
+ * Drop a reference, the last one frees the buffer.
+ *
+ * @param buf The bytes of the buffer, NULL is ignored.
+ * @param len The length the buffer was allocated with.
+ */
+void refbuf_release(void *buf, size_t len);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Slab allocator for the keys and values the server stores. Sizes are rounded
+ * up to a size class, every class carves its chunks out of SLAB_PAGE_SIZE
+ * pages, and every thread keeps a small cache of free chunks per class so most
+ * calls never touch a shared lock. Pages are never given back to the system,
+ * a freed chunk is only reused by its own class.
+ */
+
+#define SLAB_MIN_SIZE 8 // smallest chunk, also the alignment of every class
+#define SLAB_MAX_SIZE 4096 // larger requests go straight to malloc()
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_GROWTH_FACTOR 1.25 // ratio between two neighbouring classes
+
+typedef struct slab_stats_t {
+    size_t chunk_size;      // 0 for the requests larger than SLAB_MAX_SIZE
+    uint64_t pages;
+    uint64_t chunks;        // carved out of the pages so far
+    uint64_t free_chunks;   // on the shared free list of the class
+    uint64_t cached_chunks; // held by per-thread caches
+    uint64_t allocs;        // folded in whenever a thread cache touches the class
+    uint64_t frees;
+} slab_stats_t;
+
+/*
+ * Allocate size bytes from the class that fits them.
+ *
+ * @param size The number of bytes needed.
+ * @return The chunk, or NULL if no memory is left.
+ */
+void *slab_alloc(size_t size);
+
+/*
+ * Give a chunk back to its class.
+ *
+ * @param ptr The chunk to free, NULL is ignored.
+ * @param size The size the chunk was allocated with.
+ */
+void slab_free(void *ptr, size_t size);
+
+/*
+ * Copy out the statistics of every size class, followed by one entry for the
+ * requests too large for any class.
+ *
+ * @param stats The array to fill.
+ * @param num_stats The number of entries stats can hold.
+ * @return The number of entries filled in.
+ */
+int slab_get_stats(slab_stats_t *stats, int num_stats);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A minimal io_uring instance driven through the raw system calls, for
+ * servers that would rather not depend on liburing. One thread owns a ring:
+ * it takes submission entries with uring_get_sqe(), fills them in, and
+ * submits them together with uring_submit_and_wait(), which also waits for
+ * completions that it then reads with uring_peek_cqe() and uring_cqe_seen().
+ *
+ * A ring can carry a group of provided buffers. A receive that selects its
+ * buffer from the group only takes one once data has arrived, so a thousand
+ * idle connections tie up no receive buffers at all. The buffer id comes back
+ * in the completion, and the buffer goes back to the group with
+ * uring_recycle_buffer() once its bytes have been used.
+ */
+
+typedef struct uring_t {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;               // the same mapping as sq_map on kernels with a single one
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned flags;             // the IORING_SETUP_ flags the ring was created with
+} uring_t;
+
+typedef struct uring_buffers_t {
+    struct io_uring_buf_ring *ring;
+    size_t ring_len;
+    char *bufs;
+    unsigned entries;           // a power of two
+    size_t buf_size;
+    unsigned short group;       // the buffer group id receives select from
+} uring_buffers_t;
+
+/*
+ * Create a ring owned by the calling thread.
+ *
+ * @param ring The ring to set up.
+ * @param entries Submission entries, rounded up to a power of two by the kernel.
+ * @return true on success, false with errno set if io_uring is not available.
+ */
+bool uring_init(uring_t *ring, unsigned entries);
+
+/*
+ * Unmap and close a ring. Requests still in flight are cancelled.
+ *
+ * @param ring The ring.
+ */
+void uring_exit(uring_t *ring);
+
+/*
+ * Take the next submission entry, cleared. A full submission queue is
+ * submitted first to make room.
+ *
+ * @param ring The ring.
+ * @return The entry, or NULL if the kernel did not take the queued ones.
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*
+ * Submit the queued entries and wait until wait_nr completions are ready.
+ *
+ * @param ring The ring.
+ * @param wait_nr Completions to wait for, 0 submits without waiting.
+ * @return The number of entries submitted, or -1 with errno set.
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+
+/*
+ * The oldest completion not seen yet.
+ *
+ * @param ring The ring.
+ * @return The completion, or NULL if there is none.
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+
+/*
+ * Hand the completion returned by uring_peek_cqe() back to the kernel. Its
+ * fields must have been read before.
+ *
+ * @param ring The ring.
+ */
+void uring_cqe_seen(uring_t *ring);
+
+/*
+ * Register a group of entries buffers of buf_size bytes each with the ring.
+ *
+ * @param ring The ring.
+ * @param buffers The group to set up.
+ * @param group The buffer group id, unique within the ring.
+ * @param entries The number of buffers, a power of two up to 32768.
+ * @param buf_size The bytes per buffer.
+ * @return true on success, false with errno set.
+ */
+bool uring_setup_buffers(uring_t *ring, uring_buffers_t *buffers, unsigned short group,
+    unsigned entries, size_t buf_size);
+
+/*
+ * Unregister a group and free its buffers.
+ *
+ * @param ring The ring it was registered with.
+ * @param buffers The group.
+ */
+void uring_free_buffers(uring_t *ring, uring_buffers_t *buffers);
+
+/*
+ * The buffer a completion selected.
+ *
+ * @param buffers The group.
+ * @param bid The buffer id, cqe->flags >> IORING_CQE_BUFFER_SHIFT.
+ * @return Its first byte.
+ */
+static inline char *uring_buffer(uring_buffers_t *buffers, unsigned bid)
+{
+    return buffers->bufs + (size_t)bid * buffers->buf_size;
+}
+
+/*
+ * Give a buffer back to its group for the next receive.
+ *
+ * @param buffers The group.
+ * @param bid The buffer id.
+ */
+void uring_recycle_buffer(uring_buffers_t *buffers, unsigned bid);
+
+#endif
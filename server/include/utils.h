@@ -19,5 +19,6 @@
 
 uint32_t jenkins_one_at_a_time_hash(map_key_t map_key);
 int get_index(hashmap_t *self, map_key_t key);
+hashmap_t *get_shard(hashmap_t *self, map_key_t key);
 
 #endif
@@ -0,0 +1,86 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timing wheel that tells the server which keys are due to
+ * expire. Time advances in WHEEL_TICK_MS ticks. Level 0 has one slot per tick,
+ * every further level one slot per full turn of the level below, and a slot
+ * of a higher level is spread over the level below when the time reaches it.
+ * Adding a key and finding the keys due at a tick are constant time.
+ *
+ * A wheel has a single lock. A server with many writers gives each of them a
+ * wheel of its own, so PUTs never wait for each other on it.
+ *
+ * The wheel only holds copies of keys and their deadlines. It is never told
+ * about updates or deletes, so a key may come due although its entry was
+ * replaced in the meantime: the caller checks the map before removing it.
+ */
+
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS) // slots per level
+#define WHEEL_LEVELS 4 // covers 2^24 ticks, about 46 hours, longer deadlines wait in the last level
+
+typedef struct wheel_entry_t {
+    struct wheel_entry_t *next;
+    uint64_t expires; // tick the key is due at
+    size_t key_len;
+    char key[];
+} wheel_entry_t;
+
+typedef struct wheel_t {
+    pthread_mutex_t lock;
+    uint64_t current; // last tick processed
+    wheel_entry_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel_t;
+
+/*
+ * Milliseconds of CLOCK_MONOTONIC, the clock both the wheel and the maps
+ * measure deadlines with.
+ */
+uint64_t wheel_now_ms(void);
+
+/*
+ * Create an empty wheel starting at the current time.
+ *
+ * @return The new wheel, or NULL if no memory is left.
+ */
+wheel_t *wheel_create(void);
+
+/*
+ * Remember that a key is due in ttl_ms milliseconds. The deadline is rounded
+ * up to the next tick, so the key never comes due early.
+ *
+ * @param wheel The wheel to add to.
+ * @param key The key bytes, copied into the wheel.
+ * @param key_len The length of the key.
+ * @param ttl_ms Milliseconds until the key expires.
+ * @return true on success, false if no memory is left.
+ */
+bool wheel_add(wheel_t *wheel, const void *key, size_t key_len, uint32_t ttl_ms);
+
+/*
+ * Advance the wheel to the given time. Only one thread may advance a wheel.
+ * The entries of a cascading slot are placed again in small batches, and
+ * wheel_add() gets the lock in between.
+ *
+ * @param wheel The wheel to advance.
+ * @param now_ms The current time from wheel_now_ms().
+ * @return The keys that came due, chained through next. The caller frees
+ *         each of them with wheel_free_entry().
+ */
+wheel_entry_t *wheel_advance(wheel_t *wheel, uint64_t now_ms);
+
+/*
+ * Free an entry returned by wheel_advance().
+ *
+ * @param entry The entry to free.
+ */
+void wheel_free_entry(wheel_entry_t *entry);
+
+#endif
@@ -1,22 +1,59 @@
 #include "cream.h"
 #include "utils.h"
 #include "queue.h"
+#include "epoch.h"
+#include "slab.h"
+#include "wheel.h"
+#include "hash.h"
+#include "refbuf.h"
+#include "uring.h"
+#include "const.h" //TTL
 #include <ctype.h> //isdigit
 #include <string.h>
 #include <stdio.h>
 #include <sys/socket.h> //connect
+#include <sys/time.h> //struct timeval
+#include <sys/uio.h> //writev
+#include <sys/epoll.h>
+#include <fcntl.h> //O_NONBLOCK
+#include <netinet/in.h> //IPPROTO_TCP
+#include <netinet/tcp.h> //TCP_NODELAY
 #include <unistd.h> //read, write
 #include <errno.h> //errno
 #include <netdb.h> //struct addrinfo .. etc
 #include <signal.h>
+#include <sched.h> //sched_yield
 
 #define LISTENQ 1024 /* Second argument to listen() */
+#define COST_HINT 0x80 /* PUT flag, a uint32_t recompute cost follows the value */
+#define TTL_HINT 0x40 /* PUT flag, a uint32_t TTL in seconds follows the value (after the cost), 0 never expires */
+#define REAP_BATCH 64 /* expired keys the reaper removes before yielding */
+#define KEEPALIVE_IDLE_S 10 /* a kept-alive connection waiting longer for its next request is closed */
+#define CONN_BUF (8 * 1024) /* bytes read from a kept-alive connection at once, holds the largest request */
+#define PIPELINE_BATCH 64 /* responses flushed with one writev() */
+#define EVENT_BATCH 64 /* events an epoll worker takes from epoll_wait() at once */
+#define URING_ENTRIES 1024 /* submission queue entries of an io_uring worker's ring */
+#define URING_BUFFERS 256 /* receive buffers of CONN_BUF bytes an io_uring worker provides */
 
 #define USAGE(prog_name)                                                       \
   do {                                                                         \
     fprintf(stderr,                                                            \
-            "%s [-h] NUM_WORKERS PORT_NUMBERS MAX_ENTRIES \n"                  \
+            "%s [-h] [-a] [-H] [-b BACKEND] [-k] [-c] [-e POLICY] [-f HASH] [-g] [-i] [-m MAX_BYTES] [-o] [-p] [-r] [-s NUM_SHARDS] NUM_WORKERS PORT_NUMBERS MAX_ENTRIES \n"\
             "-h\t\t\tDisplay help menu\n" \
+            "-a\t\t\tGive every worker a listening socket of its own (SO_REUSEPORT) to accept from.\n"\
+            "-H\t\t\tMap the store's table on 2 MB pages and fault it in at startup (not with -g).\n"\
+            "-b BACKEND\t\tServe connections with blocking workers (default), epoll event loops or io_uring rings, the latter two keep them alive.\n"\
+            "-c\t\t\tUse a swiss table probed through one byte hash tags.\n"\
+            "-e POLICY\t\tEvict with lru (default), clock, tinylfu, arc, 2q or gdsf (extra credit map only, refused otherwise).\n"\
+            "-f HASH\t\t\tHash keys with siphash (default), wyhash or jenkins.\n"\
+            "-g\t\t\tGrow and shrink the store with its contents, rehashing incrementally.\n"\
+            "-i\t\t\tStore small keys and values inside the table.\n"\
+            "-k\t\t\tKeep connections open and serve requests on them until the client closes.\n"\
+            "-m MAX_BYTES\t\tEvict once the keys and values take MAX_BYTES (extra credit map only, refused otherwise).\n"\
+            "-o\t\t\tServe GET requests optimistically without taking the map lock.\n"\
+            "-p\t\t\tRound the table up to a power of two slots and index it with a mask (not the extra credit map).\n"\
+            "-r\t\t\tUse robin hood hashing with backward-shift deletion.\n"\
+            "-s NUM_SHARDS\t\tSplit the store into NUM_SHARDS independently locked shards (default 1).\n"\
             "NUM_WORKERS\t\tThe number of worker threads used to service requests.\n"\
             "PORT_NUMBERS\t\tPort number to listen on for incoming connections.\n"\
             "MAX_ENTRIES\t\tThe maximum number of entries that can be stored in 'cream''s underlying data store.\n", \
@@ -27,6 +64,25 @@
 
 hashmap_t *global_map;
 queue_t * global_queue;
+wheel_t **global_wheels; // one per worker, so PUTs never share a wheel lock
+int num_wheels;
+static __thread wheel_t *worker_wheel; // the wheel of the calling worker
+bool keep_alive;
+
+//how workers wait for their connections.
+typedef enum backend_t { BACKEND_BLOCKING, BACKEND_EPOLL, BACKEND_URING } backend_t;
+backend_t backend = BACKEND_BLOCKING;
+
+//every worker accepts on a SO_REUSEPORT listening socket of its own.
+bool reuse_port;
+
+//what a worker thread waits on. listenfd is its own listening socket with
+//reuse_port, the shared one for io_uring, and -1 when the main thread accepts.
+typedef struct worker_t {
+    int epoll_fd; // epoll backend only
+    int listenfd;
+    wheel_t *wheel; // where its PUTs file their keys for expiry
+} worker_t;
 
 typedef struct sockaddr SA;
 
@@ -109,8 +165,8 @@ void sample_destructor(map_key_t key, map_val_t val) {
         printf("destroy (%s,%s)\n", (char*)key.key_base, (char*)val.val_base);
     #endif
 
-    free(key.key_base);
-    free(val.val_base);
+    slab_free(key.key_base, key.key_len);
+    refbuf_release(val.val_base, val.val_len);
 }
 
 bool isNumber(char number[])
@@ -131,24 +187,57 @@ bool isNumber(char number[])
 
 
 
-void service_util(int connfd)
+//copies the part of a request a PUT hands over to the map.
+void *copy_buffer(void *buf, size_t len)
 {
-    request_header_t request_header;
-    response_header_t response_header;
-    void * key_base = calloc(1, sizeof(map_key_t));
-    void * value_base = calloc(1, sizeof(map_val_t));
+    void *copy = slab_alloc(len);
+
+    if (copy != NULL)
+        memcpy(copy, buf, len);
+    return copy;
+}
+
+//values are reference counted, a GET keeps the one it sends alive itself.
+void *copy_value(void *buf, size_t len)
+{
+    void *copy = refbuf_alloc(len);
+
+    if (copy != NULL)
+        memcpy(copy, buf, len);
+    return copy;
+}
+
+
+//true if the value answering a GET is held by a reference of its own, which
+//the caller drops with refbuf_release() once the value is written. an inline
+//value was copied into a per-thread buffer by get() instead.
+bool pinned_value(request_header_t request_header, response_header_t response_header)
+{
+    return request_header.request_code == GET && response_header.response_code == OK
+        && (global_map->inline_entries == false || response_header.value_size > INLINE_VAL_SIZE);
+}
+
 
+//runs one request against the map, the PUT flags already stripped from its
+//code. the value answering a GET stays valid after the epoch section ends,
+//see pinned_value().
+map_val_t process_request(request_header_t request_header, char *key_buf, char *value_buf,
+                          uint32_t cost, uint32_t ttl, response_header_t *result)
+{
+    response_header_t response_header = {.response_code = BAD_REQUEST, .value_size = 0};
 
-    rio_readn(connfd, &request_header, sizeof(request_header));
-    rio_readn(connfd, key_base, request_header.key_size);
-    rio_readn(connfd, value_base, request_header.value_size);
+    map_key_t key = MAP_KEY(key_buf, request_header.key_size);
+    map_val_t value = MAP_VAL(value_buf, request_header.value_size);
 
-    map_key_t key = MAP_KEY(key_base, request_header.key_size);
-    map_val_t value = MAP_VAL(value_base, request_header.value_size);
+    //values returned by get() stay alive until they are pinned below.
+    epoch_enter();
 
     //handle PUT
     if(request_header.request_code == PUT)
     {
+        #ifdef DEBUG
+            printf("receive PUT request with (key,value) : (%s,%s)\n", (char *)key.key_base,(char *)value.val_base);
+        #endif
 
 
         //check if the client's request is valid by examining the key_size and value_size.
@@ -158,20 +247,36 @@ void service_util(int connfd)
             response_header.response_code = BAD_REQUEST;
             response_header.value_size = 0;
         }
-
-
-        #ifdef DEBUG
-            printf("receive PUT request with (key,value) : (%s,%s)\n", (char *)key.key_base,(char *)value.val_base);
-        #endif
-
-        if (put(global_map, key, value, true) == true)
-        {
-            response_header.response_code = OK;
-        }
+        //an inline map copies small keys and values itself and owns the rest.
         else
         {
-            response_header.response_code = BAD_REQUEST;
-            response_header.value_size = 0;
+            if (global_map->inline_entries == false || key.key_len > INLINE_KEY_SIZE)
+                key.key_base = copy_buffer(key_buf, key.key_len);
+            if (global_map->inline_entries == false || value.val_len > INLINE_VAL_SIZE)
+                value.val_base = copy_value(value_buf, value.val_len);
+
+            //TTLs past the 49 days of a uint32_t in milliseconds are cut there.
+            map_put_opts_t put_opts = {.cost = cost, .ttl_ms = ttl > UINT32_MAX / 1000 ? UINT32_MAX : ttl * 1000};
+
+            if (put_ext(global_map, key, value, true, put_opts) == true)
+            {
+                //the reaper removes the entry once it is due, a get() in between
+                //already misses. without memory for the wheel entry only the
+                //lazy expiry remains.
+                if (ttl != 0)
+                    wheel_add(worker_wheel, key_buf, request_header.key_size, put_opts.ttl_ms);
+                response_header.response_code = OK;
+                response_header.value_size = 0;
+            }
+            else
+            {
+                if (key.key_base != key_buf)
+                    slab_free(key.key_base, key.key_len);
+                if (value.val_base != value_buf)
+                    refbuf_release(value.val_base, value.val_len);
+                response_header.response_code = BAD_REQUEST;
+                response_header.value_size = 0;
+            }
         }
 
 
@@ -190,19 +295,16 @@ void service_util(int connfd)
             response_header.response_code = BAD_REQUEST;
             response_header.value_size = 0;
         }
-
-        value = get(global_map, key);
-        #ifdef DEBUG
-            printf("retrieved val from key %s is %s\n",(char*)key.key_base, (char*)value.val_base);
-        #endif
-
-        if (value.val_len == 0)
+        else if ((value = get(global_map, key)).val_len == 0)
         {
             response_header.response_code = NOT_FOUND;
             response_header.value_size = 0;
         }
         else
         {
+            #ifdef DEBUG
+                printf("retrieved val from key %s is %s\n",(char*)key.key_base, (char*)value.val_base);
+            #endif
             response_header.response_code = OK;
             response_header.value_size = value.val_len;
         }
@@ -223,33 +325,22 @@ void service_util(int connfd)
             response_header.response_code = BAD_REQUEST;
             response_header.value_size = 0;
         }
-
-
-        map_node_t node = delete(global_map, key);
-
-        if ( node.key.key_len == 0 && node.val.val_len == 0 )
-        {
-              //do nothing
-        }
         else
         {
-            for (int i = 0; i < global_map->capacity;i++)
+            map_node_t node = delete(global_map, key);
+
+            //delete() hands the removed entry back to us, lock-free readers may
+            //still be copying it so it is retired rather than destroyed. parts
+            //stored inline come back without a base.
+            if (node.key.key_len != 0 && (node.key.key_base != NULL || node.val.val_base != NULL))
             {
-                if (global_map->nodes[i].key.key_base == node.key.key_base)
-                {
-                    global_map->destroy_function(global_map->nodes[i].key, global_map->nodes[i].val);
-                    global_map->nodes[i].key.key_base = NULL;
-                    global_map->nodes[i].val.val_base = NULL;
-                    global_map->nodes[i].key.key_len = 0;
-                    global_map->nodes[i].val.val_len = 0;
-                }
+                epoch_retire(global_map->destroy_function, node.key, node.val);
             }
-
+            //once the EVICT operation has completed the server will send a response message back
+            // to the client with a response_code of OK and value_size of 0
+            response_header.response_code = OK;
+            response_header.value_size = 0;
         }
-        //once the EVICT operation has completed the server will send a response message back
-        // to the client with a response_code of OK and value_size of 0
-        response_header.response_code = OK;
-        response_header.value_size = 0;
     }
     //handle CLEAR
     else if(request_header.request_code == CLEAR)
@@ -276,29 +367,740 @@ void service_util(int connfd)
         response_header.value_size = 0;
     }
 
-    // sending a response to the client
+    //a value the map owns gets a reference of its own, so the epoch section
+    //ends before the write, however long a slow client makes it take.
+    if (pinned_value(request_header, response_header))
+        refbuf_acquire(value.val_base);
+    epoch_exit();
+
+    *result = response_header;
+    return value;
+}
+
+
+//serves a single request read straight from the connection.
+void service_util(int connfd)
+{
+    request_header_t request_header;
+    response_header_t response_header = {.response_code = BAD_REQUEST, .value_size = 0};
+    uint32_t cost = 1;
+    uint32_t ttl = TTL;
+    //requests are read on the stack, the map only gets heap copies of what it keeps.
+    char key_buf[MAX_KEY_SIZE];
+    char value_buf[MAX_VALUE_SIZE];
+
+
+    if (rio_readn(connfd, &request_header, sizeof(request_header)) != sizeof(request_header))
+        return;
+
+    //the buffers cannot hold an oversized request, answer it from its header alone.
+    if (request_header.key_size > MAX_KEY_SIZE || request_header.value_size > MAX_VALUE_SIZE)
+    {
+        rio_writen(connfd, &response_header, sizeof(response_header));
+        return;
+    }
+
+    if (rio_readn(connfd, key_buf, request_header.key_size) != request_header.key_size
+        || rio_readn(connfd, value_buf, request_header.value_size) != request_header.value_size)
+        return;
+
+    //protocol extension: a PUT may carry the cost of recomputing its value
+    //and its own TTL, in that order.
+    if ((request_header.request_code & ~(COST_HINT | TTL_HINT)) == PUT)
+    {
+        if ((request_header.request_code & COST_HINT) && rio_readn(connfd, &cost, sizeof(cost)) != sizeof(cost))
+            return;
+        if ((request_header.request_code & TTL_HINT) && rio_readn(connfd, &ttl, sizeof(ttl)) != sizeof(ttl))
+            return;
+        request_header.request_code = PUT;
+    }
+
+    map_val_t value = process_request(request_header, key_buf, value_buf, cost, ttl, &response_header);
+    bool pinned = pinned_value(request_header, response_header);
+
+    // sending a response to the client, straight from the map's buffer
     rio_writen(connfd, &response_header, sizeof(response_header));
     rio_writen(connfd, value.val_base, response_header.value_size);
+
+    if (pinned)
+        refbuf_release(value.val_base, value.val_len);
+}
+
+
+//the responses to the pipelined requests of one read, in request order. a
+//value is written from the map's buffer, or from inline_vals for a value get()
+//copied into its per-thread buffer, which the next GET reuses.
+typedef struct response_batch_t {
+    struct iovec iov[2 * PIPELINE_BATCH];
+    int iovcnt;
+    int iov_done; // vectors written completely, a non-blocking socket may take them in parts
+    response_header_t headers[PIPELINE_BATCH];
+    int count;
+    map_val_t pinned[PIPELINE_BATCH];
+    int num_pinned;
+    char inline_vals[PIPELINE_BATCH][INLINE_VAL_SIZE];
+} response_batch_t;
+
+//the parser waits for the header of the next request, then for the rest of it.
+typedef enum parse_state_t { PARSE_HEADER, PARSE_BODY } parse_state_t;
+
+//a connection served many requests: what was read but not served yet, where
+//the parser stands, and the responses not written yet.
+typedef struct conn_t {
+    int fd;
+    char buf[CONN_BUF];
+    size_t len; // bytes in buf
+    size_t pos; // start of the first request not served yet
+    parse_state_t state;
+    size_t frame_len; // of the request at pos, once its header is parsed
+    bool writing; // registered for EPOLLOUT instead of EPOLLIN, epoll backend only
+    bool closing; // answered an oversized request, ends once the batch is written
+    response_batch_t batch;
+} conn_t;
+
+
+//a connection with nothing read and nothing to write yet, NULL without memory.
+conn_t *create_conn(int connfd)
+{
+    conn_t *conn = malloc(sizeof(conn_t));
+
+    if (conn == NULL)
+        return NULL;
+    conn->fd = connfd;
+    conn->len = 0;
+    conn->pos = 0;
+    conn->state = PARSE_HEADER;
+    conn->frame_len = 0;
+    conn->writing = false;
+    conn->closing = false;
+    conn->batch.iovcnt = 0;
+    conn->batch.iov_done = 0;
+    conn->batch.count = 0;
+    conn->batch.num_pinned = 0;
+    return conn;
+}
+
+
+//steps the parser over the bytes read so far. returns the length of the
+//complete request at conn->pos, 0 while more bytes are needed, or -1 for a
+//request too large for the buffers.
+ssize_t parse_request(conn_t *conn)
+{
+    request_header_t request_header;
+    size_t avail = conn->len - conn->pos;
+
+    switch (conn->state)
+    {
+        case PARSE_HEADER:
+            if (avail < sizeof(request_header))
+                return 0;
+            memcpy(&request_header, conn->buf + conn->pos, sizeof(request_header));
+            if (request_header.key_size > MAX_KEY_SIZE || request_header.value_size > MAX_VALUE_SIZE)
+                return -1;
+
+            conn->frame_len = sizeof(request_header) + request_header.key_size + request_header.value_size;
+            if ((request_header.request_code & ~(COST_HINT | TTL_HINT)) == PUT)
+            {
+                if (request_header.request_code & COST_HINT)
+                    conn->frame_len += sizeof(uint32_t);
+                if (request_header.request_code & TTL_HINT)
+                    conn->frame_len += sizeof(uint32_t);
+            }
+            conn->state = PARSE_BODY;
+            // fall through
+        case PARSE_BODY:
+            if (avail < conn->frame_len)
+                return 0;
+            conn->state = PARSE_HEADER;
+            return conn->frame_len;
+    }
+    return -1;
+}
+
+
+//runs the complete request at the front of buf and queues its response.
+void serve_buffered(char *buf, response_batch_t *batch)
+{
+    request_header_t request_header;
+    response_header_t *response_header = &batch->headers[batch->count++];
+    uint32_t cost = 1;
+    uint32_t ttl = TTL;
+
+    memcpy(&request_header, buf, sizeof(request_header));
+    char *key_buf = buf + sizeof(request_header);
+    char *value_buf = key_buf + request_header.key_size;
+    char *hints = value_buf + request_header.value_size;
+
+    if ((request_header.request_code & ~(COST_HINT | TTL_HINT)) == PUT)
+    {
+        if (request_header.request_code & COST_HINT)
+        {
+            memcpy(&cost, hints, sizeof(cost));
+            hints += sizeof(cost);
+        }
+        if (request_header.request_code & TTL_HINT)
+            memcpy(&ttl, hints, sizeof(ttl));
+        request_header.request_code = PUT;
+    }
+
+    map_val_t value = process_request(request_header, key_buf, value_buf, cost, ttl, response_header);
+
+    batch->iov[batch->iovcnt++] = (struct iovec) {.iov_base = response_header, .iov_len = sizeof(*response_header)};
+    if (response_header->value_size == 0)
+        return;
+
+    if (pinned_value(request_header, *response_header))
+    {
+        batch->pinned[batch->num_pinned++] = value;
+    }
+    else
+    {
+        memcpy(batch->inline_vals[batch->count - 1], value.val_base, response_header->value_size);
+        value.val_base = batch->inline_vals[batch->count - 1];
+    }
+    batch->iov[batch->iovcnt++] = (struct iovec) {.iov_base = value.val_base, .iov_len = response_header->value_size};
+}
+
+
+//lets go of the values of a batch, written or not, and empties it.
+void release_responses(response_batch_t *batch)
+{
+    for (int i = 0; i < batch->num_pinned; i++)
+        refbuf_release(batch->pinned[i].val_base, batch->pinned[i].val_len);
+    batch->iovcnt = 0;
+    batch->iov_done = 0;
+    batch->count = 0;
+    batch->num_pinned = 0;
+}
+
+
+//marks n more bytes of the batch written. a short write continues inside the
+//first vector it did not finish. returns true once every vector is out.
+bool advance_responses(response_batch_t *batch, size_t n)
+{
+    struct iovec *iov = &batch->iov[batch->iov_done];
+
+    while (batch->iov_done < batch->iovcnt && n >= iov->iov_len)
+    {
+        n -= iov->iov_len;
+        iov++;
+        batch->iov_done++;
+    }
+    if (batch->iov_done < batch->iovcnt)
+    {
+        iov->iov_base = (char *)iov->iov_base + n;
+        iov->iov_len -= n;
+    }
+    return batch->iov_done == batch->iovcnt;
+}
+
+
+//writes the queued responses with as few writev() calls as the socket allows.
+//1 once all of them are out, 0 if a non-blocking socket filled up first and
+//the rest waits for EPOLLOUT, -1 if the client is gone.
+int flush_responses(conn_t *conn)
+{
+    response_batch_t *batch = &conn->batch;
+
+    while (batch->iov_done < batch->iovcnt)
+    {
+        ssize_t n = writev(conn->fd, &batch->iov[batch->iov_done], batch->iovcnt - batch->iov_done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        else if (n < 0)
+            break;
+        advance_responses(batch, n);
+    }
+
+    bool sent = batch->iov_done == batch->iovcnt;
+    release_responses(batch);
+    return sent ? 1 : -1;
+}
+
+
+//runs complete requests from the buffer until none is left or the batch is
+//full. returns what the parser returned last: 0 while the next request is
+//incomplete, -1 at an oversized one, its length if the batch filled up first.
+ssize_t queue_requests(conn_t *conn)
+{
+    ssize_t frame = 0;
+
+    while (conn->batch.count < PIPELINE_BATCH && (frame = parse_request(conn)) > 0)
+    {
+        serve_buffered(conn->buf + conn->pos, &conn->batch);
+        conn->pos += frame;
+    }
+    return frame;
+}
+
+
+//an oversized request is answered from its header alone, its payload cannot
+//be told apart from the next request, so the connection ends after it. the
+//answer is queued like any other response, a non-blocking socket may not
+//take it right away.
+void reject_request(conn_t *conn)
+{
+    response_batch_t *batch = &conn->batch;
+    response_header_t *response_header = &batch->headers[batch->count++];
+
+    response_header->response_code = BAD_REQUEST;
+    response_header->value_size = 0;
+    batch->iov[batch->iovcnt++] = (struct iovec) {.iov_base = response_header, .iov_len = sizeof(*response_header)};
+    conn->closing = true;
+}
+
+
+//an incomplete request moves to the front, to be completed by the next read.
+void compact_buffer(conn_t *conn)
+{
+    memmove(conn->buf, conn->buf + conn->pos, conn->len - conn->pos);
+    conn->len -= conn->pos;
+    conn->pos = 0;
+}
+
+
+//runs every complete request read so far and writes their responses, a batch
+//at a time, after the responses still queued from before. returns like
+//flush_responses(), 1 once every complete request is answered.
+int serve_requests(conn_t *conn)
+{
+    ssize_t frame = 0;
+    int flushed = flush_responses(conn);
+
+    //the answer to an oversized request is out.
+    if (flushed == 1 && conn->closing == true)
+        return -1;
+
+    while (flushed == 1)
+    {
+        frame = queue_requests(conn);
+        if (conn->batch.count == 0)
+            break;
+        flushed = flush_responses(conn);
+    }
+    if (flushed != 1)
+        return flushed;
+
+    if (frame < 0)
+    {
+        reject_request(conn);
+        flushed = flush_responses(conn);
+        return flushed == 1 ? -1 : flushed;
+    }
+    compact_buffer(conn);
+    return 1;
+}
+
+
+//lets go of a connection of the epoll or io_uring backend, with whatever it
+//still had queued.
+void close_conn(conn_t *conn)
+{
+    release_responses(&conn->batch);
+    close(conn->fd);
+    free(conn);
+}
+
+
+//serves a kept-alive connection until the client closes it. every read takes
+//whatever the client has sent, all the complete requests in it run in order,
+//and their responses go out together, so a client that pipelines its requests
+//pays two syscalls per batch rather than several per request.
+void service_pipelined(int connfd)
+{
+    conn_t *conn = create_conn(connfd);
+
+    while (conn != NULL)
+    {
+        ssize_t n = read(connfd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n <= 0)
+            break;
+        conn->len += n;
+        if (serve_requests(conn) != 1)
+            break;
+    }
+    free(conn);
+}
+
+
+//hands an accepted connection to the epoll set of a worker, which serves it from now on.
+void add_connection(int epfd, int connfd)
+{
+    conn_t *conn = create_conn(connfd);
+    int nodelay = 1;
+
+    if (conn == NULL)
+    {
+        close(connfd);
+        return;
+    }
+    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &event) < 0)
+    {
+        close(connfd);
+        free(conn);
+    }
+}
+
+
+//a worker of the epoll backend. every connection handed to it is registered
+//for EPOLLIN, or for EPOLLOUT alone while its responses wait for room in the
+//socket, which keeps it from reading more requests than it can answer. with
+//reuse_port its own listening socket is in the set too, without a connection.
+void * event_loop(void *arg)
+{
+    worker_t *worker = arg;
+    int epfd = worker->epoll_fd;
+    struct epoll_event events[EVENT_BATCH];
+
+    pthread_detach(pthread_self());
+    worker_wheel = worker->wheel;
+
+    if (worker->listenfd >= 0)
+    {
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+
+        fcntl(worker->listenfd, F_SETFL, fcntl(worker->listenfd, F_GETFL) | O_NONBLOCK);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker->listenfd, &event) < 0)
+            unix_error("Failed to watch the listening socket");
+    }
+
+    while (1)
+    {
+        int n = epoll_wait(epfd, events, EVENT_BATCH, -1);
+
+        for (int i = 0; i < n; i++)
+        {
+            conn_t *conn = events[i].data.ptr;
+            int served = 1;
+
+            //takes every connection waiting, the listening socket does not block.
+            if (conn == NULL)
+            {
+                int connfd;
+
+                while ((connfd = accept(worker->listenfd, NULL, NULL)) >= 0)
+                    add_connection(epfd, connfd);
+                continue;
+            }
+
+            //level triggered, one read per event leaves the rest to the next epoll_wait().
+            if (conn->writing == false)
+            {
+                ssize_t nread = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+
+                if (nread > 0)
+                    conn->len += nread;
+                else if (nread == 0 || (errno != EAGAIN && errno != EINTR))
+                    served = -1;
+            }
+            if (served == 1)
+                served = serve_requests(conn);
+
+            //closing the descriptor takes it out of the epoll set.
+            if (served < 0)
+            {
+                close_conn(conn);
+            }
+            else if ((served == 0) != conn->writing)
+            {
+                struct epoll_event event = {.events = served == 0 ? EPOLLOUT : EPOLLIN, .data.ptr = conn};
+
+                conn->writing = served == 0;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+            }
+        }
+    }
+    return NULL;
+}
+
+
+//what an io_uring completion finished, kept in the low bits of the user data
+//next to its connection. a multishot accept has no connection.
+typedef enum uring_op_t { URING_ACCEPT, URING_RECV, URING_SEND } uring_op_t;
+#define URING_OP_MASK 3
+
+
+//asks for every connection the listening socket accepts from now on.
+void uring_accept(uring_t *ring, int listenfd)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL)
+        unix_error("Failed to submit an accept");
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_ACCEPT;
+}
+
+
+//reads into whichever provided buffer is free once data arrives, no more
+//than fits behind what the connection holds already.
+void uring_recv(uring_t *ring, uring_buffers_t *buffers, conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL)
+    {
+        close_conn(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->len = sizeof(conn->buf) - conn->len;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers->group;
+    sqe->user_data = (uintptr_t)conn | URING_RECV;
+}
+
+
+//writes the responses of the batch not written yet, headers and values alike.
+void uring_send(uring_t *ring, conn_t *conn)
+{
+    response_batch_t *batch = &conn->batch;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL)
+    {
+        close_conn(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)&batch->iov[batch->iov_done];
+    sqe->len = batch->iovcnt - batch->iov_done;
+    sqe->user_data = (uintptr_t)conn | URING_SEND;
+}
+
+
+//runs the complete requests a connection has buffered and writes their
+//responses, or reads more. a connection has one of the two in flight at a
+//time, it reads again only once its responses are written.
+void uring_serve(uring_t *ring, uring_buffers_t *buffers, conn_t *conn)
+{
+    ssize_t frame = queue_requests(conn);
+
+    if (conn->batch.count > 0)
+    {
+        uring_send(ring, conn);
+    }
+    else if (frame < 0)
+    {
+        reject_request(conn);
+        uring_send(ring, conn);
+    }
+    else
+    {
+        compact_buffer(conn);
+        uring_recv(ring, buffers, conn);
+    }
+}
+
+
+//a worker of the io_uring backend. its ring keeps a multishot accept on the
+//listening socket, so connections come to whichever worker takes them
+//without passing the main thread, and one receive or one write per
+//connection. receives draw from a group of buffers shared by the worker's
+//connections, and every completion a wait returns is handled before the
+//operations it led to are submitted together.
+void * uring_loop(void *arg)
+{
+    int listenfd = ((worker_t *)arg)->listenfd;
+    uring_t ring;
+    uring_buffers_t buffers;
+
+    pthread_detach(pthread_self());
+    worker_wheel = ((worker_t *)arg)->wheel;
+
+    if (!uring_init(&ring, URING_ENTRIES) || !uring_setup_buffers(&ring, &buffers, 0, URING_BUFFERS, CONN_BUF))
+    {
+        unix_error("Failed to set up io_uring (the backend needs Linux 5.19 or later)");
+    }
+    uring_accept(&ring, listenfd);
+
+    while (1)
+    {
+        struct io_uring_cqe *cqe;
+
+        uring_submit_and_wait(&ring, 1);
+        while ((cqe = uring_peek_cqe(&ring)) != NULL)
+        {
+            uintptr_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            conn_t *conn = (conn_t *)(data & ~(uintptr_t)URING_OP_MASK);
+
+            uring_cqe_seen(&ring);
+            switch (data & URING_OP_MASK)
+            {
+                case URING_ACCEPT:
+                    if (res >= 0 && (conn = create_conn(res)) == NULL)
+                    {
+                        close(res);
+                    }
+                    else if (res >= 0)
+                    {
+                        int nodelay = 1;
+                        setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+                        uring_recv(&ring, &buffers, conn);
+                    }
+                    //the kernel ends a multishot accept on errors, such as
+                    //running out of descriptors.
+                    if (!(flags & IORING_CQE_F_MORE))
+                        uring_accept(&ring, listenfd);
+                    break;
+
+                case URING_RECV:
+                    //every buffer taken by receives not handled yet, try again.
+                    if (res == -ENOBUFS)
+                    {
+                        uring_recv(&ring, &buffers, conn);
+                        break;
+                    }
+                    else if (res <= 0)
+                    {
+                        close_conn(conn);
+                        break;
+                    }
+                    memcpy(conn->buf + conn->len, uring_buffer(&buffers, flags >> IORING_CQE_BUFFER_SHIFT), res);
+                    uring_recycle_buffer(&buffers, flags >> IORING_CQE_BUFFER_SHIFT);
+                    conn->len += res;
+                    uring_serve(&ring, &buffers, conn);
+                    break;
+
+                case URING_SEND:
+                    if (res <= 0)
+                    {
+                        close_conn(conn);
+                    }
+                    else if (!advance_responses(&conn->batch, res))
+                    {
+                        uring_send(&ring, conn);
+                    }
+                    else if (conn->closing == true)
+                    {
+                        close_conn(conn);
+                    }
+                    else
+                    {
+                        release_responses(&conn->batch);
+                        uring_serve(&ring, &buffers, conn);
+                    }
+                    break;
+            }
+        }
+    }
+    return NULL;
 }
 
 
-void * service()
+void * service(void *arg)
 {
+    worker_t *worker = arg;
+
     pthread_detach(pthread_self());
+    worker_wheel = worker->wheel;
 
     while(1)
     {
-        int connfd = *((int *)dequeue(global_queue)); //remove connfd from queue
-        service_util(connfd); //service client
+        int connfd;
+
+        //with reuse_port the kernel spreads the connections over the workers'
+        //listening sockets, and a worker takes its own without the queue.
+        if (worker->listenfd >= 0)
+        {
+            if ((connfd = accept(worker->listenfd, NULL, NULL)) < 0)
+                continue;
+        }
+        else
+        {
+            connfd = (int)(intptr_t)dequeue(global_queue); //remove connfd from queue
+        }
+
+        //with keep-alive the connection stays with this worker until the client
+        //closes it or leaves it idle for KEEPALIVE_IDLE_S, which frees the worker
+        //for the connections waiting in the queue. without TCP_NODELAY a small
+        //batch of responses waits for the client to ACK the previous one.
+        if (keep_alive)
+        {
+            struct timeval idle = {.tv_sec = KEEPALIVE_IDLE_S};
+            int nodelay = 1;
+            setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            service_pipelined(connfd);
+        }
+        else
+        {
+            service_util(connfd); //service client
+        }
         close(connfd);
     }
 }
 
 
+//removes the entries a wheel reports due, REAP_BATCH at a time so a burst of
+//expiries does not keep the map locks away from the workers for long. the
+//map checks the deadline of the entry itself, a key that was put again with a
+//later deadline, maybe through another worker's wheel, or deleted meanwhile
+//stays as it is.
+void reap_entries(wheel_entry_t *entry)
+{
+    int reaped = 0;
+
+    while (entry != NULL)
+    {
+        wheel_entry_t *next = entry->next;
+        map_node_t node = delete_expired(global_map, MAP_KEY(entry->key, entry->key_len));
+
+        //retired like an EVICT, a lock-free reader may still be copying it.
+        if (node.key.key_len != 0 && (node.key.key_base != NULL || node.val.val_base != NULL))
+        {
+            #ifdef DEBUG
+                printf("expired key %.*s\n", (int)entry->key_len, entry->key);
+            #endif
+            epoch_retire(global_map->destroy_function, node.key, node.val);
+        }
+        wheel_free_entry(entry);
+        entry = next;
+
+        if (++reaped % REAP_BATCH == 0)
+            sched_yield();
+    }
+}
+
+//advances every worker's wheel once per tick.
+void * reaper(void *arg)
+{
+    pthread_detach(pthread_self());
+
+    while(1)
+    {
+        uint64_t now = wheel_now_ms();
+
+        for (int i = 0; i < num_wheels; i++)
+            reap_entries(wheel_advance(global_wheels[i], now));
+        usleep(WHEEL_TICK_MS * 1000);
+    }
+    return NULL;
+}
+
+
 //the server creates a listening descriptor that is ready to receive connection requests
 //by calling the open_listenfd function.
 //it returns listening descriptor that is ready to receive connection requests on port port.
-int open_listenfd(char *port) {
+//with reuse_port several of them can be bound to the same port, one per worker,
+//and the kernel balances the incoming connections over them.
+int open_listenfd(char *port, bool reuse_port) {
     struct addrinfo hints, *listp, *p;
     int listenfd, optval = 1;
 
@@ -320,6 +1122,11 @@ int open_listenfd(char *port) {
         /* Eliminates "Address already in use" error from bind */
         setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
                    sizeof(int));
+        if (reuse_port && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (const void *)&optval,
+                   sizeof(int)) < 0) {
+            close(listenfd);
+            continue;
+        }
 
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -347,20 +1154,98 @@ int main(int argc, char *argv[]) {
     int NUM_WORKERS;
     char * PORT_NUMBERS;
     int MAX_ENTRIES;
+    map_opts_t map_opts = {.num_shards = 1};
+    hash_func_f hash_function = find_hash(NULL);
+    int opt;
 
     if (argc == 1)
     {
         USAGE(argv[0]);
         exit(EXIT_FAILURE);
     }
-    else if(strcmp(argv[1],"-h") == 0)
+
+    while ((opt = getopt(argc, argv, "haHb:ce:f:gikm:oprs:")) != -1)
     {
-        USAGE(argv[0]);
-        exit(EXIT_SUCCESS);
+        switch (opt)
+        {
+            case 'h':
+                USAGE(argv[0]);
+                exit(EXIT_SUCCESS);
+            case 'a':
+                reuse_port = true;
+                break;
+            case 'H':
+                map_opts.huge_pages = true;
+                break;
+            case 'b':
+                if (strcmp(optarg, "blocking") == 0)
+                    backend = BACKEND_BLOCKING;
+                else if (strcmp(optarg, "epoll") == 0)
+                    backend = BACKEND_EPOLL;
+                else if (strcmp(optarg, "io_uring") == 0)
+                    backend = BACKEND_URING;
+                else
+                {
+                    USAGE(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                map_opts.swiss_table = true;
+                break;
+            case 'e':
+                map_opts.eviction = optarg;
+                break;
+            case 'f':
+                if ((hash_function = find_hash(optarg)) == NULL)
+                {
+                    USAGE(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                map_opts.growable = true;
+                break;
+            case 'i':
+                map_opts.inline_entries = true;
+                break;
+            case 'k':
+                keep_alive = true;
+                break;
+            case 'm':
+                if (!isNumber(optarg) || atoll(optarg) < 1)
+                {
+                    USAGE(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                map_opts.max_bytes = atoll(optarg);
+                break;
+            case 'o':
+                map_opts.optimistic_get = true;
+                break;
+            case 'p':
+                map_opts.pow2_capacity = true;
+                break;
+            case 'r':
+                map_opts.robin_hood = true;
+                break;
+            case 's':
+                if (!isNumber(optarg) || atoi(optarg) < 1)
+                {
+                    USAGE(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                map_opts.num_shards = atoi(optarg);
+                break;
+            default:
+                USAGE(argv[0]);
+                exit(EXIT_FAILURE);
+        }
     }
-    else if(argc == 4 && strcmp(argv[1],"-h") != 0)
+
+    if (argc - optind == 3)
     {
-        for(int i = 1; i < argc;i++)
+        for(int i = optind; i < argc;i++)
         {
             if(!isNumber(argv[i]))
             {
@@ -369,9 +1254,9 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        NUM_WORKERS = atoi(argv[1]);
-        MAX_ENTRIES = atoi(argv[3]);
-        PORT_NUMBERS = argv[2];
+        NUM_WORKERS = atoi(argv[optind]);
+        MAX_ENTRIES = atoi(argv[optind + 2]);
+        PORT_NUMBERS = argv[optind + 1];
 
     }
     else
@@ -387,34 +1272,95 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    int listenfd, connfd;
+    int listenfd = -1, connfd, next_worker = 0;
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
 
-    //bind a socket to the port specified by PORT_NUMBER
-    listenfd = open_listenfd(PORT_NUMBERS);
+    //bind a socket to the port specified by PORT_NUMBER. with reuse_port the
+    //workers bind their own below, a shared socket nobody accepts from would
+    //take its share of the connections.
+    if (!reuse_port && (listenfd = open_listenfd(PORT_NUMBERS, false)) < 0)
+    {
+        unix_error("Failed to listen on PORT_NUMBER");
+    }
+
 
+    //clients choose the keys, the keyed hashes use a key they cannot know.
+    if (!hash_seed_random())
+    {
+        unix_error("Failed to seed the key hash");
+    }
 
     //initialization. the request queue is an instance of queue_t.
     //underlying data store is an instance of hashmap_with capacity MAX_ENTRIES
-    global_map = create_map(MAX_ENTRIES, jenkins_one_at_a_time_hash, sample_destructor);
+    global_map = create_map_opts(MAX_ENTRIES, hash_function, sample_destructor, map_opts);
     global_queue = create_queue();
 
+    if (global_map == NULL)
+    {
+        unix_error("Failed to create the map (NUM_SHARDS must not exceed MAX_ENTRIES, POLICY must be known, -e and -m need the extra credit build, -H excludes -g)");
+    }
+
+    //entries expire TTL seconds after their PUT unless it asks otherwise.
+    global_wheels = calloc(NUM_WORKERS, sizeof(wheel_t *));
+    num_wheels = NUM_WORKERS;
+    for (int index = 0; index < NUM_WORKERS; index++)
+    {
+        if (global_wheels == NULL || (global_wheels[index] = wheel_create()) == NULL)
+        {
+            unix_error("Failed to create the expiry wheels");
+        }
+    }
+
 
 
     pthread_t tid;
+    worker_t *workers = calloc(NUM_WORKERS, sizeof(worker_t));
 
     // On startup, cream spawn NUM_WORKERS worker threads for the lifetime of the program.
     // each thread for each new client. The server consists of a main thread and a set of
     // worker threads. the main thread repeatedly accepts connection requests from clients
     // and places the resulting connected descriptors in a bounded buffer.
+    // an epoll worker waits on an epoll set of its own instead, and serves every
+    // connection in it until the client closes the connection. an io_uring worker
+    // accepts its connections itself, and so does every worker with reuse_port.
     for(int index = 0; index < NUM_WORKERS; index++) {
-        if(pthread_create(&tid, NULL, service, NULL) != 0)
+        void *(*worker)(void *) = service;
+
+        workers[index].listenfd = backend == BACKEND_URING ? listenfd : -1;
+        workers[index].wheel = global_wheels[index];
+        if (reuse_port && (workers[index].listenfd = open_listenfd(PORT_NUMBERS, true)) < 0)
+        {
+            unix_error("Failed to listen on PORT_NUMBER with SO_REUSEPORT");
+        }
+
+        if (backend == BACKEND_EPOLL && (workers[index].epoll_fd = epoll_create1(0)) < 0)
+        {
+            unix_error("Failed to create an epoll instance");
+        }
+
+        if (backend == BACKEND_EPOLL)
+            worker = event_loop;
+        else if (backend == BACKEND_URING)
+            worker = uring_loop;
+
+        if(pthread_create(&tid, NULL, worker, &workers[index]) != 0)
         {
             exit(EXIT_FAILURE);
         }
     }
 
+    if(pthread_create(&tid, NULL, reaper, NULL) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    //the workers accept on their own, the main thread has nothing left to do.
+    while (backend == BACKEND_URING || reuse_port)
+    {
+        pause();
+    }
+
     // infinite server loop, accepting connection requests and inserting the resulting
     // connected descriptors in queue
     //infinitely listen on the bound socket for incoming connections.
@@ -427,10 +1373,20 @@ int main(int argc, char *argv[]) {
         //clients' connection request will be accepted in cream's main thread.
         connfd = accept(listenfd, (SA *) &clientaddr, &clientlen);
 
+        if (connfd < 0)
+            continue;
+        else if (backend == BACKEND_EPOLL)
+        {
+            add_connection(workers[next_worker].epoll_fd, connfd);
+            next_worker = (next_worker + 1) % NUM_WORKERS;
+            continue;
+        }
+
         //after accepting the client's connection, main thread adds the accepted socket
         //to a request queue so taht a blocked worker thread is unblocked to service
-        //the client's request.
-        enqueue(global_queue, &connfd) ;//insert connfd in queue
+        //the client's request. the descriptor travels as the item itself, a pointer
+        //to connfd would already see the next connection when a worker reads it.
+        enqueue(global_queue, (void *)(intptr_t)connfd) ;//insert connfd in queue
     }
 
     exit(0);
@@ -0,0 +1,196 @@
+#include "epoch.h"
+#include <stdio.h>
+
+#define EPOCH_RETIRE_BATCH 64 // retirements between two attempts to advance the epoch
+
+// one record per thread that ever entered a critical section. records are
+// never freed, a record whose thread exited is handed to the next new thread.
+typedef struct epoch_record_t {
+    uint64_t epoch;  // global epoch observed by the current critical section
+    bool active;     // inside a critical section
+    bool in_use;     // owned by a live thread
+    int depth;       // nesting of epoch_enter(), only touched by the owner
+    struct epoch_record_t *next;
+} epoch_record_t;
+
+// retired entry waiting for every reader of its epoch to leave.
+typedef struct limbo_node_t {
+    uint64_t epoch;
+    destructor_f destroy_function;
+    map_key_t key;
+    map_val_t val;
+    struct limbo_node_t *next;
+} limbo_node_t;
+
+static uint64_t global_epoch;
+
+static epoch_record_t *records;
+static pthread_mutex_t records_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static __thread epoch_record_t *thread_record;
+
+static limbo_node_t *limbo_front, *limbo_rear;
+static unsigned long limbo_cnt;
+static uint64_t reclaimed_cnt;
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//hand the record of an exiting thread to the next thread that needs one.
+static void release_record(void *arg)
+{
+    epoch_record_t *record = arg;
+
+    pthread_mutex_lock(&records_lock);
+    record->depth = 0;
+    __atomic_store_n(&record->active, false, __ATOMIC_RELEASE);
+    record->in_use = false;
+    pthread_mutex_unlock(&records_lock);
+}
+
+static void create_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+static epoch_record_t *get_record(void)
+{
+    epoch_record_t *record;
+
+    if (thread_record != NULL)
+        return thread_record;
+
+    pthread_once(&record_key_once, create_record_key);
+
+    pthread_mutex_lock(&records_lock);
+    for (record = records; record != NULL; record = record->next)
+    {
+        if (record->in_use == false)
+            break;
+    }
+    if (record == NULL)
+    {
+        if ((record = calloc(1, sizeof(epoch_record_t))) == NULL)
+        {
+            pthread_mutex_unlock(&records_lock);
+            fprintf(stderr, "epoch: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        record->next = records;
+        __atomic_store_n(&records, record, __ATOMIC_RELEASE); //readers walk the list without the lock
+    }
+    record->in_use = true;
+    pthread_mutex_unlock(&records_lock);
+
+    pthread_setspecific(record_key, record);
+    thread_record = record;
+    return record;
+}
+
+void epoch_enter(void)
+{
+    epoch_record_t *record = get_record();
+
+    if (record->depth++ > 0)
+        return;
+
+    __atomic_store_n(&record->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_store_n(&record->active, true, __ATOMIC_RELAXED);
+    //the record must be visible before we read any shared memory.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+    epoch_record_t *record = thread_record;
+
+    if (--record->depth > 0)
+        return;
+
+    __atomic_store_n(&record->active, false, __ATOMIC_RELEASE);
+}
+
+//the epoch can move on once every active thread has observed the current one.
+//must be called with limbo_lock held.
+static void try_advance(void)
+{
+    uint64_t epoch = global_epoch;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (epoch_record_t *record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record != NULL;
+        record = record->next)
+    {
+        if (__atomic_load_n(&record->active, __ATOMIC_ACQUIRE)
+            && __atomic_load_n(&record->epoch, __ATOMIC_RELAXED) != epoch)
+            return;
+    }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(destructor_f destroy_function, map_key_t key, map_val_t val)
+{
+    limbo_node_t *node = calloc(1, sizeof(limbo_node_t));
+    limbo_node_t *expired = NULL;
+
+    //without a limbo node the entry cannot be freed safely, leaking it is the lesser evil.
+    if (node == NULL)
+        return;
+
+    node->destroy_function = destroy_function;
+    node->key = key;
+    node->val = val;
+
+    pthread_mutex_lock(&limbo_lock);
+    node->epoch = global_epoch;
+    if (limbo_rear == NULL)
+        limbo_front = node;
+    else
+        limbo_rear->next = node;
+    limbo_rear = node;
+
+    if (++limbo_cnt % EPOCH_RETIRE_BATCH == 0)
+    {
+        try_advance();
+
+        //nodes retired two epochs ago can no longer be referenced by anyone.
+        limbo_node_t **tail = &expired;
+        while (limbo_front != NULL && limbo_front->epoch + 2 <= global_epoch)
+        {
+            *tail = limbo_front;
+            tail = &limbo_front->next;
+            limbo_front = limbo_front->next;
+        }
+        *tail = NULL;
+        if (limbo_front == NULL)
+            limbo_rear = NULL;
+    }
+    pthread_mutex_unlock(&limbo_lock);
+
+    //run the destructors outside the lock.
+    while (expired != NULL)
+    {
+        node = expired;
+        expired = expired->next;
+        node->destroy_function(node->key, node->val);
+        free(node);
+        __atomic_fetch_add(&reclaimed_cnt, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void free_destructor(map_key_t key, map_val_t val)
+{
+    free(key.key_base);
+}
+
+void epoch_free(void *ptr)
+{
+    epoch_retire(free_destructor, MAP_KEY(ptr, 0), MAP_VAL(NULL, 0));
+}
+
+void epoch_get_stats(epoch_stats_t *stats)
+{
+    pthread_mutex_lock(&limbo_lock);
+    stats->retired = limbo_cnt;
+    pthread_mutex_unlock(&limbo_lock);
+    stats->reclaimed = __atomic_load_n(&reclaimed_cnt, __ATOMIC_RELAXED);
+}
@@ -1,57 +1,835 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
 #include "utils.h"
+#include "epoch.h"
+#include "hugepage.h"
+#include "wheel.h" // wheel_now_ms
 #include <errno.h>
 #include <stdio.h>
 #include <string.h> // memcmp
 
+#define LRU_NIL -1 // end of the LRU list
+#define SKETCH_DEPTH 4 // rows of the count-min sketch
+#define SKETCH_MAX 15 // counters saturate like 4 bit ones
+#define SKETCH_MIN_WIDTH 16
+#define SKETCH_SAMPLE 10 // the counters are halved after SKETCH_SAMPLE * capacity increments
+#define WINDOW_PERCENT 1 // share of the capacity taken by the TinyLFU window
+#define PROBE_ALARM 64 // slots a lookup may visit before it counts as a probe alarm
+#define MAX_LOAD_PERCENT 75 // share of the slots a full map fills
 
-#define INF 2147483647;
+static const uint32_t sketch_seeds[SKETCH_DEPTH] = {0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F};
 
 void print_map_info(hashmap_t * self){
+    if (self->shards != NULL)
+    {
+        for (int i = 0; i < self->num_shards; i++)
+        {
+            printf("\n********\tshard %d\t********", i);
+            print_map_info(&self->shards[i]);
+        }
+        return;
+    }
+
     printf("\n********\tCurrent map info\t********\n");
-    printf("map capacity : %d\n", self->capacity);
+    printf("map capacity : %d (%d slots)\n", self->max_entries, self->capacity);
     printf("map size : %d\n", self->size);
+    printf("eviction policy : %s\n", self->policy->name);
+    for (int i = 0; i < 2; i++)
+        printf("list %d : %d -> %d (%u entries, %u ghosts)\n", i, self->lists[i].head, self->lists[i].tail,
+            self->lists[i].size, self->ghosts[i].size);
     for (int i =0; i < self->capacity ;i++)
     {
 
         if (self->nodes[i].tombstone == true )
-            printf("accessIdx : %d , map[%d] : tomstone(deleted before)\n",self->nodes[i].accessIdx, i);
+            printf("map[%d] : tomstone(deleted before)\n", i);
         else if (self->nodes[i].key.key_base == NULL)
-            printf("accessIdx : %d , map[%d] : empty\n",self->nodes[i].accessIdx, i );
+            printf("map[%d] : empty\n", i );
         else
-            printf("accessIdx : %d , map[%d] : (%s,%s)\n",self->nodes[i].accessIdx,
-             i,(char*)self->nodes[i].key.key_base, (char*)self->nodes[i].val.val_base);
+            printf("list %d : %d <- -> %d , map[%d] : (%s,%s)\n", self->nodes[i].list,
+             self->nodes[i].link.prev, self->nodes[i].link.next, i,(char*)self->nodes[i].key.key_base, (char*)self->nodes[i].val.val_base);
     }
     printf("*************************************************\n\n");
 }
 
-hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
+//the policy lists are threaded through the nodes (or the ghosts) by index, the
+//most recently used entry at the head and the next victim at the tail. they
+//are only modified with the map lock held for writing, or with fields_lock
+//under the read lock.
+static lru_link_t *linkOf(hashmap_t *self, lru_list_t *list, int idx)
+{
+    return list->ghost == true ? &self->ghost_nodes[idx].link : &self->nodes[idx].link;
+}
+
+static void lruUnlink(hashmap_t *self, lru_list_t *list, int idx)
+{
+    lru_link_t *link = linkOf(self, list, idx);
+
+    if (link->prev == LRU_NIL)
+        list->head = link->next;
+    else
+        linkOf(self, list, link->prev)->next = link->next;
+
+    if (link->next == LRU_NIL)
+        list->tail = link->prev;
+    else
+        linkOf(self, list, link->next)->prev = link->prev;
+    list->size--;
+}
+
+static void lruPushFront(hashmap_t *self, lru_list_t *list, int idx)
+{
+    lru_link_t *link = linkOf(self, list, idx);
+
+    link->prev = LRU_NIL;
+    link->next = list->head;
+    if (list->head == LRU_NIL)
+        list->tail = idx;
+    else
+        linkOf(self, list, list->head)->prev = idx;
+    list->head = idx;
+    list->size++;
+}
+
+//moves a hit entry to the head of its list.
+static void lruTouch(hashmap_t *self, lru_list_t *list, int idx)
+{
+    if (list->head == idx)
+        return;
+    lruUnlink(self, list, idx);
+    lruPushFront(self, list, idx);
+}
+
+static int lruPopTail(hashmap_t *self, lru_list_t *list)
+{
+    int idx = list->tail;
+
+    lruUnlink(self, list, idx);
+    return idx;
+}
+
+static lru_list_t *listOf(hashmap_t *self, int idx)
+{
+    return &self->lists[self->nodes[idx].list];
+}
+
+static void linkNode(hashmap_t *self, int idx, int list)
+{
+    self->nodes[idx].list = list;
+    lruPushFront(self, &self->lists[list], idx);
+}
+
+static void unlinkNode(hashmap_t *self, int idx)
+{
+    lruUnlink(self, listOf(self, idx), idx);
+}
+
+//moves a node to the head of another list.
+static void moveNode(hashmap_t *self, int idx, int list)
+{
+    unlinkNode(self, idx);
+    linkNode(self, idx, list);
+}
 
-    if (hash_function == NULL || destroy_function == NULL)
+//a deletion moved a node from slot from to slot to, its neighbours and its
+//list learn the new index.
+static void relinkNode(hashmap_t *self, int from, int to)
+{
+    lru_list_t *list = listOf(self, to);
+    lru_link_t *link = &self->nodes[to].link;
+
+    if (link->prev == LRU_NIL)
+        list->head = to;
+    else
+        self->nodes[link->prev].link.next = to;
+
+    if (link->next == LRU_NIL)
+        list->tail = to;
+    else
+        self->nodes[link->next].link.prev = to;
+}
+
+//ARC and 2Q remember evicted keys by their hash in the ghost lists. the ghosts
+//come from a pool of ghost_cap entries and are found through a small linear
+//probing set, so checking a new key costs no more than a map lookup.
+static bool allocGhosts(hashmap_t *self, uint32_t count)
+{
+    uint32_t slots = 2;
+
+    while (slots < 2 * count)
+        slots <<= 1;
+    self->ghost_cap = count;
+    self->ghost_nodes = (map_ghost_t *)calloc(count, sizeof(map_ghost_t));
+    self->ghost_index = (int32_t *)malloc(slots * sizeof(int32_t));
+    self->ghost_mask = slots - 1;
+    return self->ghost_nodes != NULL && self->ghost_index != NULL;
+}
+
+//empties every policy list, used by init_map() and clear_map().
+static void resetPolicy(hashmap_t *self)
+{
+    for (int i = 0; i < 2; i++)
     {
-        errno = EINVAL;
-        return NULL;
+        self->lists[i] = (lru_list_t) {LRU_NIL, LRU_NIL, 0, false};
+        self->ghosts[i] = (lru_list_t) {LRU_NIL, LRU_NIL, 0, true};
     }
+    self->clock_hand = 0;
+    self->admit_list = LRU_NIL;
+    self->heap_size = 0;
+    self->inflation = 0;
+
+    self->ghost_free = self->ghost_cap > 0 ? 0 : LRU_NIL;
+    for (int i = 0; i < self->ghost_cap; i++)
+        self->ghost_nodes[i].link.next = i + 1 < self->ghost_cap ? i + 1 : LRU_NIL;
+    if (self->ghost_index != NULL)
+        memset(self->ghost_index, 0xFF, (self->ghost_mask + 1) * sizeof(int32_t)); //all LRU_NIL
+}
 
-    hashmap_t * hashmap = (hashmap_t *)calloc(1, sizeof(hashmap_t));
+static int ghostFind(hashmap_t *self, uint32_t hash)
+{
+    for (uint32_t i = hash & self->ghost_mask; self->ghost_index[i] != LRU_NIL; i = (i + 1) & self->ghost_mask)
+    {
+        if (self->ghost_nodes[self->ghost_index[i]].hash == hash)
+            return self->ghost_index[i];
+    }
+    return LRU_NIL;
+}
+
+static void ghostRemove(hashmap_t *self, int ghost)
+{
+    uint32_t i = self->ghost_nodes[ghost].hash & self->ghost_mask;
 
-    if (hashmap == NULL)
+    while (self->ghost_index[i] != ghost)
+        i = (i + 1) & self->ghost_mask;
+
+    //backward shift deletion: pull every following entry of the cluster that
+    //is not at or behind its home slot into the hole.
+    for (uint32_t j = (i + 1) & self->ghost_mask; self->ghost_index[j] != LRU_NIL; j = (j + 1) & self->ghost_mask)
     {
-        return NULL;
+        uint32_t home = self->ghost_nodes[self->ghost_index[j]].hash & self->ghost_mask;
+        if (((j - home) & self->ghost_mask) >= ((j - i) & self->ghost_mask))
+        {
+            self->ghost_index[i] = self->ghost_index[j];
+            i = j;
+        }
     }
+    self->ghost_index[i] = LRU_NIL;
+
+    lruUnlink(self, &self->ghosts[self->ghost_nodes[ghost].list], ghost);
+    self->ghost_nodes[ghost].link.next = self->ghost_free;
+    self->ghost_free = ghost;
+}
+
+static void ghostDropTail(hashmap_t *self, int list)
+{
+    if (self->ghosts[list].tail != LRU_NIL)
+        ghostRemove(self, self->ghosts[list].tail);
+}
+
+static void ghostAdd(hashmap_t *self, int list, uint32_t hash)
+{
+    //the policies keep within the pool, this only guards against odd sizes.
+    if (self->ghost_free == LRU_NIL)
+        ghostDropTail(self, self->ghosts[list].size > 0 ? list : !list);
+
+    int ghost = self->ghost_free;
+    uint32_t i = hash & self->ghost_mask;
+
+    self->ghost_free = self->ghost_nodes[ghost].link.next;
+    self->ghost_nodes[ghost].hash = hash;
+    self->ghost_nodes[ghost].list = list;
+    lruPushFront(self, &self->ghosts[list], ghost);
+
+    while (self->ghost_index[i] != LRU_NIL)
+        i = (i + 1) & self->ghost_mask;
+    self->ghost_index[i] = ghost;
+}
+
+//LRU: every entry on lists[0], a hit moves it to the head and the tail goes.
+static void lruInsert(hashmap_t *self, int idx)
+{
+    linkNode(self, idx, 0);
+}
+
+//readers share the map lock, so every list update on a hit needs fields_lock.
+static void lruHit(hashmap_t *self, int idx)
+{
+    pthread_mutex_lock(&self->fields_lock);
+    lruTouch(self, listOf(self, idx), idx);
+    pthread_mutex_unlock(&self->fields_lock);
+}
+
+static int lruVictim(hashmap_t *self, uint32_t hash)
+{
+    return lruPopTail(self, &self->lists[0]);
+}
+
+//CLOCK keeps a reference bit per slot instead of a list: a hit only sets the
+//bit, and on eviction the hand clears set bits until it reaches an entry
+//without one. only called on a full map, so it ends within two sweeps.
+static void clockInsert(hashmap_t *self, int idx)
+{
+    self->nodes[idx].referenced = false;
+}
+
+static void clockHit(hashmap_t *self, int idx)
+{
+    //skip the store when the bit is set, the cache line stays shared.
+    if (__atomic_load_n(&self->nodes[idx].referenced, __ATOMIC_RELAXED) == false)
+        __atomic_store_n(&self->nodes[idx].referenced, true, __ATOMIC_RELAXED);
+}
 
-    hashmap->capacity = capacity;
+static void clockDelete(hashmap_t *self, int idx)
+{
+}
+
+//the reference bit moves with the node.
+static void clockMove(hashmap_t *self, int from, int to)
+{
+}
+
+static int clockVictim(hashmap_t *self, uint32_t hash)
+{
+    while(1)
+    {
+        int idx = self->clock_hand;
+        map_node_t *node = &self->nodes[idx];
+
+        if (++self->clock_hand == self->capacity)
+            self->clock_hand = 0;
+
+        if (node->key.key_base == NULL || node->tombstone == true)
+            continue;
+        else if (__atomic_load_n(&node->referenced, __ATOMIC_RELAXED) == false)
+            return idx;
+        __atomic_store_n(&node->referenced, false, __ATOMIC_RELAXED);
+    }
+}
+
+//TinyLFU counts every access of a key in a count-min sketch: one counter per
+//row is picked by the hash, and the smallest of them bounds the real count.
+static uint8_t *sketchCounter(hashmap_t *self, int row, uint32_t hash)
+{
+    return &self->sketch[(row << (32 - self->sketch_shift)) + ((hash * sketch_seeds[row]) >> self->sketch_shift)];
+}
+
+static uint32_t sketchFrequency(hashmap_t *self, uint32_t hash)
+{
+    uint32_t freq = SKETCH_MAX;
+
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        if (*sketchCounter(self, row, hash) < freq)
+            freq = *sketchCounter(self, row, hash);
+    }
+    return freq;
+}
+
+//halving every counter once in a while lets old popularity fade away. the
+//sample size is counted in 64 bits, ten times a large capacity overflows 32.
+static void sketchIncrement(hashmap_t *self, uint32_t hash)
+{
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        uint8_t *counter = sketchCounter(self, row, hash);
+        if (*counter < SKETCH_MAX)
+            (*counter)++;
+    }
+
+    if (++self->sketch_ops >= (uint64_t)SKETCH_SAMPLE * self->max_entries)
+    {
+        for (uint32_t i = 0; i < SKETCH_DEPTH << (32 - self->sketch_shift); i++)
+            self->sketch[i] >>= 1;
+        self->sketch_ops /= 2;
+    }
+}
+
+//W-TinyLFU: lists[1] is a window of WINDOW_PERCENT of the capacity that every
+//new key enters, lists[0] the main LRU list.
+static bool tinylfuInit(hashmap_t *self)
+{
+    uint32_t width = SKETCH_MIN_WIDTH;
+
+    //one row per seed, each a power of two at least as wide as the capacity.
+    self->sketch_shift = 32 - 4;
+    while (width < self->max_entries)
+    {
+        width <<= 1;
+        self->sketch_shift--;
+    }
+    self->sketch = (uint8_t *)calloc(SKETCH_DEPTH * width, sizeof(uint8_t));
+    self->target = self->max_entries * WINDOW_PERCENT / 100 > 0 ? self->max_entries * WINDOW_PERCENT / 100 : 1;
+    return self->sketch != NULL;
+}
+
+//a window that is over its share while the map still has room passes its
+//tail on to the main list.
+static void tinylfuInsert(hashmap_t *self, int idx)
+{
+    sketchIncrement(self, self->nodes[idx].hash);
+    linkNode(self, idx, 1);
+    if (self->lists[1].size > self->target)
+        moveNode(self, self->lists[1].tail, 0);
+}
+
+static void tinylfuHit(hashmap_t *self, int idx)
+{
+    pthread_mutex_lock(&self->fields_lock);
+    sketchIncrement(self, self->nodes[idx].hash);
+    lruTouch(self, listOf(self, idx), idx);
+    pthread_mutex_unlock(&self->fields_lock);
+}
+
+//once the window is full, its least recently used entry is the candidate for
+//the main list. it only gets in if the sketch has seen it more often than the
+//main list's victim, otherwise the candidate itself is evicted, so a burst of
+//keys seen once can not flush the frequently used ones.
+static int tinylfuVictim(hashmap_t *self, uint32_t hash)
+{
+    int candidate = self->lists[1].tail;
+    int victim = self->lists[0].tail;
+
+    if (victim == LRU_NIL)
+        return lruPopTail(self, &self->lists[1]);
+    else if (candidate == LRU_NIL || self->lists[1].size < self->target)
+        return lruPopTail(self, &self->lists[0]);
+
+    if (sketchFrequency(self, self->nodes[candidate].hash) > sketchFrequency(self, self->nodes[victim].hash))
+    {
+        moveNode(self, candidate, 0);
+        return lruPopTail(self, &self->lists[0]);
+    }
+    return lruPopTail(self, &self->lists[1]);
+}
+
+//ARC (Megiddo and Modha): lists[0] (T1) holds keys seen once recently,
+//lists[1] (T2) keys seen at least twice, and the ghost lists B1 and B2 the
+//keys evicted from each. a new key that is found in B1 means T1 was too
+//small, one in B2 that T2 was, and target (p) moves towards the list that
+//would have kept it.
+static bool arcInit(hashmap_t *self)
+{
+    self->target = 0;
+    return allocGhosts(self, self->max_entries);
+}
+
+//a ghost hit adapts the target and brings the key back into T2.
+static void arcAdapt(hashmap_t *self, int ghost)
+{
+    uint32_t b1 = self->ghosts[0].size, b2 = self->ghosts[1].size;
+
+    if (self->ghost_nodes[ghost].list == 0)
+    {
+        uint32_t delta = b2 > b1 ? b2 / b1 : 1;
+        self->target = self->target + delta < self->max_entries ? self->target + delta : self->max_entries;
+    }
+    else
+    {
+        uint32_t delta = b1 > b2 ? b1 / b2 : 1;
+        self->target = self->target > delta ? self->target - delta : 0;
+    }
+    ghostRemove(self, ghost);
+    self->admit_list = 1;
+}
+
+//REPLACE of the paper: evict from T1 while it is over its target.
+static int arcReplace(hashmap_t *self, bool in_b2)
+{
+    uint32_t t1 = self->lists[0].size;
+    int list = 1;
+
+    if (t1 > 0 && (t1 > self->target || (in_b2 == true && t1 == self->target) || self->lists[1].size == 0))
+        list = 0;
+
+    int victim = lruPopTail(self, &self->lists[list]);
+    ghostAdd(self, list, self->nodes[victim].hash);
+    return victim;
+}
+
+//keeps |T1| + |B1| within the capacity and all four lists within twice of it.
+static void arcTrimGhosts(hashmap_t *self)
+{
+    if (self->lists[0].size + self->ghosts[0].size >= self->max_entries)
+        ghostDropTail(self, 0);
+    else if (self->size + self->ghosts[0].size + self->ghosts[1].size >= 2 * self->max_entries)
+        ghostDropTail(self, 1);
+}
+
+static int arcVictim(hashmap_t *self, uint32_t hash)
+{
+    //a large value may need several victims, but the key is only looked up once.
+    if (self->admit_list == LRU_NIL)
+    {
+        int ghost = ghostFind(self, hash);
+
+        if (ghost != LRU_NIL)
+        {
+            bool in_b2 = self->ghost_nodes[ghost].list == 1;
+            arcAdapt(self, ghost);
+            return arcReplace(self, in_b2);
+        }
+        self->admit_list = 0;
+    }
+    else if (self->admit_list == 1)
+    {
+        return arcReplace(self, false);
+    }
+
+    //T1 fills the whole map: its tail goes without leaving a ghost.
+    if (self->lists[0].size == self->max_entries)
+        return lruPopTail(self, &self->lists[0]);
+    arcTrimGhosts(self);
+    return arcReplace(self, false);
+}
+
+//arcVictim() already placed the key when the map was full.
+static void arcInsert(hashmap_t *self, int idx)
+{
+    if (self->admit_list == LRU_NIL)
+    {
+        int ghost = ghostFind(self, self->nodes[idx].hash);
+
+        if (ghost != LRU_NIL)
+        {
+            arcAdapt(self, ghost);
+        }
+        else
+        {
+            arcTrimGhosts(self);
+            self->admit_list = 0;
+        }
+    }
+
+    linkNode(self, idx, self->admit_list);
+    self->admit_list = LRU_NIL;
+}
+
+//any hit promotes the entry to the head of T2.
+static void arcHit(hashmap_t *self, int idx)
+{
+    pthread_mutex_lock(&self->fields_lock);
+    if (self->nodes[idx].list == 0)
+        moveNode(self, idx, 1);
+    else
+        lruTouch(self, &self->lists[1], idx);
+    pthread_mutex_unlock(&self->fields_lock);
+}
+
+//2Q (Johnson and Shasha): new keys enter lists[1] (A1in), a FIFO of a quarter
+//of the capacity. keys pushed out of it are remembered in ghosts[0] (A1out,
+//half the capacity), and only a key requested again while in A1out makes it
+//into lists[0] (Am), the LRU list of the hot keys.
+static bool twoqInit(hashmap_t *self)
+{
+    self->target = self->max_entries / 4 > 0 ? self->max_entries / 4 : 1;
+    return allocGhosts(self, self->max_entries / 2 > 0 ? self->max_entries / 2 : 1);
+}
+
+static void twoqInsert(hashmap_t *self, int idx)
+{
+    int ghost = ghostFind(self, self->nodes[idx].hash);
+
+    if (ghost != LRU_NIL)
+    {
+        ghostRemove(self, ghost);
+        linkNode(self, idx, 0);
+    }
+    else
+    {
+        linkNode(self, idx, 1);
+    }
+}
+
+//a hit in A1in is ignored, so only hits on hot keys take fields_lock.
+static void twoqHit(hashmap_t *self, int idx)
+{
+    if (self->nodes[idx].list == 1)
+        return;
+    lruHit(self, idx);
+}
+
+static int twoqVictim(hashmap_t *self, uint32_t hash)
+{
+    if (self->lists[1].size > self->target || self->lists[0].size == 0)
+    {
+        int victim = lruPopTail(self, &self->lists[1]);
+        if (self->ghosts[0].size == self->ghost_cap)
+            ghostDropTail(self, 0);
+        ghostAdd(self, 0, self->nodes[victim].hash);
+        return victim;
+    }
+    return lruPopTail(self, &self->lists[0]);
+}
+
+//GDSF (Greedy-Dual-Size-Frequency, Cherkasova): an entry's priority is
+//L + frequency * cost / size, where L is the priority of the last victim. the
+//lowest priority goes first, so large entries that are seldom requested make
+//room before small or expensive ones, and L lets every new priority overtake
+//the entries that stopped being requested. the nodes sit in a binary min-heap.
+static bool gdsfInit(hashmap_t *self)
+{
+    self->heap = (int32_t *)malloc(self->max_entries * sizeof(int32_t));
+    return self->heap != NULL;
+}
+
+static void heapSet(hashmap_t *self, uint32_t pos, int idx)
+{
+    self->heap[pos] = idx;
+    self->nodes[idx].heap_pos = pos;
+}
+
+static void heapUp(hashmap_t *self, uint32_t pos)
+{
+    int idx = self->heap[pos];
+
+    while (pos > 0)
+    {
+        uint32_t parent = (pos - 1) / 2;
+        if (self->nodes[self->heap[parent]].priority <= self->nodes[idx].priority)
+            break;
+        heapSet(self, pos, self->heap[parent]);
+        pos = parent;
+    }
+    heapSet(self, pos, idx);
+}
+
+static void heapDown(hashmap_t *self, uint32_t pos)
+{
+    int idx = self->heap[pos];
+
+    while (2 * pos + 1 < self->heap_size)
+    {
+        uint32_t child = 2 * pos + 1;
+        if (child + 1 < self->heap_size
+            && self->nodes[self->heap[child + 1]].priority < self->nodes[self->heap[child]].priority)
+            child++;
+        if (self->nodes[self->heap[child]].priority >= self->nodes[idx].priority)
+            break;
+        heapSet(self, pos, self->heap[child]);
+        pos = child;
+    }
+    heapSet(self, pos, idx);
+}
+
+//moves a node whose priority changed to its new place.
+static void heapFix(hashmap_t *self, int idx)
+{
+    heapUp(self, self->nodes[idx].heap_pos);
+    heapDown(self, self->nodes[idx].heap_pos);
+}
+
+static void gdsfPrioritize(hashmap_t *self, int idx)
+{
+    map_node_t *node = &self->nodes[idx];
+
+    node->priority = self->inflation + (double)node->freq * node->cost / (node->key.key_len + node->val.val_len);
+}
+
+static void gdsfInsert(hashmap_t *self, int idx)
+{
+    self->nodes[idx].freq = 1;
+    gdsfPrioritize(self, idx);
+    heapSet(self, self->heap_size++, idx);
+    heapUp(self, self->heap_size - 1);
+}
+
+static void gdsfHit(hashmap_t *self, int idx)
+{
+    pthread_mutex_lock(&self->fields_lock);
+    self->nodes[idx].freq++;
+    gdsfPrioritize(self, idx);
+    heapFix(self, idx);
+    pthread_mutex_unlock(&self->fields_lock);
+}
+
+static void gdsfDelete(hashmap_t *self, int idx)
+{
+    int last = self->heap[--self->heap_size];
+
+    if (last == idx)
+        return;
+    heapSet(self, self->nodes[idx].heap_pos, last);
+    heapFix(self, last);
+}
+
+static void gdsfMove(hashmap_t *self, int from, int to)
+{
+    heapSet(self, self->nodes[to].heap_pos, to);
+}
+
+static int gdsfVictim(hashmap_t *self, uint32_t hash)
+{
+    int victim = self->heap[0];
+
+    self->inflation = self->nodes[victim].priority;
+    gdsfDelete(self, victim);
+    return victim;
+}
+
+static const map_policy_t policies[] = {
+    {.name = "lru", .on_insert = lruInsert, .on_hit = lruHit, .on_delete = unlinkNode,
+     .on_move = relinkNode, .choose_victim = lruVictim},
+    {.name = "clock", .on_insert = clockInsert, .on_hit = clockHit, .on_delete = clockDelete,
+     .on_move = clockMove, .choose_victim = clockVictim},
+    {.name = "tinylfu", .init = tinylfuInit, .on_insert = tinylfuInsert, .on_hit = tinylfuHit,
+     .on_delete = unlinkNode, .on_move = relinkNode, .choose_victim = tinylfuVictim},
+    {.name = "arc", .init = arcInit, .on_insert = arcInsert, .on_hit = arcHit, .on_delete = unlinkNode,
+     .on_move = relinkNode, .choose_victim = arcVictim},
+    {.name = "2q", .init = twoqInit, .on_insert = twoqInsert, .on_hit = twoqHit, .on_delete = unlinkNode,
+     .on_move = relinkNode, .choose_victim = twoqVictim},
+    {.name = "gdsf", .init = gdsfInit, .on_insert = gdsfInsert, .on_hit = gdsfHit, .on_delete = gdsfDelete,
+     .on_move = gdsfMove, .choose_victim = gdsfVictim},
+};
+
+//NULL selects LRU, an unknown name NULL.
+static const map_policy_t *findPolicy(const char *name)
+{
+    if (name == NULL)
+        return &policies[0];
+
+    for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+    {
+        if (strcmp(policies[i].name, name) == 0)
+            return &policies[i];
+    }
+    return NULL;
+}
+
+//a full map still leaves a quarter of its slots free, so every probe ends at an
+//empty slot instead of walking the whole table.
+static uint64_t tableSize(uint32_t max_entries)
+{
+    return ((uint64_t)max_entries * 100 + MAX_LOAD_PERCENT - 1) / MAX_LOAD_PERCENT;
+}
+
+static void hugeDestructor(map_key_t key, map_val_t val)
+{
+    huge_free(key.key_base, key.key_len);
+}
+
+//frees the tables of a map that never held an entry, when create_map_opts() gives up.
+static void freeTable(hashmap_t *self)
+{
+    if (self->huge_pages == true)
+        huge_free(self->nodes, (size_t)self->capacity * sizeof(map_node_t));
+    else
+        free(self->nodes);
+    free(self->sketch);
+    free(self->ghost_nodes);
+    free(self->ghost_index);
+    free(self->heap);
+}
+
+//false if there is no memory for the table or the policy's state.
+static bool init_map(hashmap_t *hashmap, uint32_t capacity, hash_func_f hash_function,
+                     destructor_f destroy_function, map_opts_t opts)
+{
+    hashmap->max_entries = capacity;
+    hashmap->capacity = tableSize(capacity);
     hashmap->size = 0;
-    hashmap->nodes = (map_node_t *)calloc(capacity, sizeof(map_node_t)); //make an array.
-    for (int i = 0; i < capacity ; i++)
-    hashmap->nodes[i].accessIdx = INF;
+    hashmap->huge_pages = opts.huge_pages;
+    if (opts.huge_pages == true)
+        hashmap->nodes = huge_alloc((size_t)hashmap->capacity * sizeof(map_node_t));
+    else
+        hashmap->nodes = (map_node_t *)calloc(hashmap->capacity, sizeof(map_node_t)); //make an array.
     hashmap->hash_function = hash_function;
     hashmap->destroy_function = destroy_function;
-    hashmap->num_readers = 0;
-    hashmap->accessCnt = 0;
+    hashmap->bytes = 0;
+    hashmap->max_bytes = opts.max_bytes;
+    hashmap->policy = findPolicy(opts.eviction);
 
-    pthread_mutex_init(&hashmap->write_lock, NULL);
+    //the top level map of a sharded one never stores anything.
+    if (capacity > 0 && (hashmap->nodes == NULL
+        || (hashmap->policy->init != NULL && !hashmap->policy->init(hashmap))))
+    {
+        return false;
+    }
+    resetPolicy(hashmap);
+
+    //writers are preferred so a steady stream of readers can never starve put()/delete().
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&hashmap->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
     pthread_mutex_init(&hashmap->fields_lock, NULL);
     hashmap->invalid = false;
+    hashmap->inline_entries = false;
+    hashmap->probe_alarms = 0;
+    hashmap->num_shards = 0;
+    hashmap->shards = NULL;
+    return true;
+}
+
+hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
+    return create_map_opts(capacity, hash_function, destroy_function, (map_opts_t) {.num_shards = 1});
+}
+
+hashmap_t *create_map_opts(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function,
+                           map_opts_t opts) {
+
+    //slots are indexed with an int.
+    if (hash_function == NULL || destroy_function == NULL || opts.num_shards > capacity
+        || findPolicy(opts.eviction) == NULL || tableSize(capacity) > INT32_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    hashmap_t * hashmap;
+
+    if (posix_memalign((void **)&hashmap, __alignof__(hashmap_t), sizeof(hashmap_t)) != 0)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(hashmap, 0, sizeof(hashmap_t));
+
+    if (opts.num_shards <= 1)
+    {
+        //a table of several GB may not be there, from huge pages or at all.
+        if (!init_map(hashmap, capacity, hash_function, destroy_function, opts))
+        {
+            freeTable(hashmap);
+            free(hashmap);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    else
+    {
+        //the top level map only routes keys, every shard is a complete map of its own.
+        init_map(hashmap, 0, hash_function, destroy_function, opts);
+        hashmap->max_entries = capacity;
+
+        if (posix_memalign((void **)&hashmap->shards, __alignof__(hashmap_t),
+            opts.num_shards * sizeof(hashmap_t)) != 0)
+        {
+            freeTable(hashmap);
+            free(hashmap);
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(hashmap->shards, 0, opts.num_shards * sizeof(hashmap_t));
+        hashmap->num_shards = opts.num_shards;
+
+        //spread the capacity and the byte budget evenly, the first shards take the
+        //remainder. the shards built before one that gets no memory are freed again.
+        for (int i = 0; i < opts.num_shards; i++)
+        {
+            map_opts_t shard_opts = opts;
+            shard_opts.max_bytes = opts.max_bytes / opts.num_shards + (i < opts.max_bytes % opts.num_shards);
+            if (!init_map(&hashmap->shards[i], capacity / opts.num_shards + (i < capacity % opts.num_shards),
+                hash_function, destroy_function, shard_opts))
+            {
+                for (int j = 0; j <= i; j++)
+                    freeTable(&hashmap->shards[j]);
+                free(hashmap->shards);
+                freeTable(hashmap);
+                free(hashmap);
+                errno = ENOMEM;
+                return NULL;
+            }
+        }
+    }
 
     #ifdef DEBUG
         printf("initialized the map!\n");
@@ -60,16 +838,27 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
     return hashmap;
 }
 
+//the slot a hash starts probing at, a power of two capacity is masked.
+static inline uint32_t homeSlot(uint32_t hash, uint32_t capacity)
+{
+    return (capacity & (capacity - 1)) == 0 ? hash & (capacity - 1) : hash % capacity;
+}
+
 //return -1 if key doesn't exist on Map
-int linearProbing(hashmap_t *self, map_key_t key, int idx)
+int linearProbing(hashmap_t *self, map_key_t key, uint32_t hash)
 {
     #ifdef DEBUG
            printf("linearProbling function is called\n");
     #endif
 
+    int idx = homeSlot(hash, self->capacity);
     int movCnt = 0;
     while(1)
     {
+        //a chain this long hints at keys crafted against the hash function.
+        if (movCnt == PROBE_ALARM)
+            __atomic_fetch_add(&self->probe_alarms, 1, __ATOMIC_RELAXED);
+
         //if couldn't find target key after searching all elements
         //in full map, make decision that key doest not exist!
         if (movCnt == self->capacity)
@@ -79,19 +868,6 @@ int linearProbing(hashmap_t *self, map_key_t key, int idx)
             #endif
             return -1;
         }
-        //skip over a tombstone
-        else if (self->nodes[idx].tombstone == true)
-        {
-            idx++; //linear probing
-            if(idx == self->capacity)
-                idx = 0;
-            movCnt++;
-            #ifdef DEBUG
-                 printf("skipping tombstone, next idex : %d", idx);
-            #endif
-
-            continue;
-        }
         //1)when slot is empty make decision that key doest not exist!
         else if (self->nodes[idx].key.key_base == NULL)
         {
@@ -100,10 +876,9 @@ int linearProbing(hashmap_t *self, map_key_t key, int idx)
             #endif
             return -1;
         }
-        else if ( self->nodes[idx].key.key_base != NULL
-            && memcmp(self->nodes[idx].key.key_base, key.key_base, key.key_len) == 0
-            && memcmp(self->nodes[idx].key.key_base, key.key_base, self->nodes[idx].key.key_len) == 0
-            && self->nodes[idx].tombstone == false)
+        //the cached hash and length rule out other keys without touching their bytes.
+        else if (self->nodes[idx].hash == hash && self->nodes[idx].key.key_len == key.key_len
+            && memcmp(self->nodes[idx].key.key_base, key.key_base, key.key_len) == 0)
         {
             #ifdef DEBUG
             printf("result : key exists!\n");
@@ -118,114 +893,146 @@ int linearProbing(hashmap_t *self, map_key_t key, int idx)
     }
 }
 
+//backward shift deletion: every following entry of the cluster whose home slot
+//does not lie between the hole and itself moves back into the hole. no slot is
+//ever left as a tombstone, so the free quarter of the table stays empty and
+//ends every probe.
+static void removeSlot(hashmap_t *self, int idx)
+{
+    int next = idx;
 
-bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    while(1)
+    {
+        if (++next == self->capacity)
+            next = 0;
+        if (self->nodes[next].key.key_base == NULL)
+            break;
+
+        uint32_t home = homeSlot(self->nodes[next].hash, self->capacity);
+        if ((next + self->capacity - home) % self->capacity >= (next + self->capacity - idx) % self->capacity)
+        {
+            self->nodes[idx] = self->nodes[next];
+            self->policy->on_move(self, next, idx);
+            idx = next;
+        }
+    }
+    self->nodes[idx].key = MAP_KEY(NULL, 0);
+    self->nodes[idx].val = MAP_VAL(NULL, 0);
+    self->nodes[idx].tombstone = false;
+}
+
+
+//an entry whose deadline has passed is gone for get(), the clock is only read
+//for entries that have one.
+static inline bool expired(uint64_t expires)
+{
+    return expires != 0 && expires <= wheel_now_ms();
+}
 
+bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    return put_ext(self, key, val, force, (map_put_opts_t) {.cost = 1});
+}
 
-    pthread_mutex_lock(&self->write_lock);
+bool put_ext(hashmap_t *self, map_key_t key, map_val_t val, bool force, map_put_opts_t opts) {
 
     if (self == NULL)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
-
         return false;
     }
-    else if ( val.val_base == NULL || key.key_base == NULL || self->invalid == true)
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return put_ext(get_shard(self, key), key, val, force, opts);
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
+
+    if ( val.val_base == NULL || key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
-    else if (self->capacity == self->size && force == false)
+    else if (self->max_entries == self->size && force == false)
     {
         errno = ENOMEM;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
-    int idx = get_index(self, key); //get an index from key.
+    uint32_t hash = self->hash_function(key);
+    uint64_t expires = opts.ttl_ms != 0 ? wheel_now_ms() + opts.ttl_ms : 0;
+    int idx = homeSlot(hash, self->capacity); //get an index from key.
     int tmp;
 
 
     //if the key already exists in the map, update the value associated with it.
-    if ( (tmp = linearProbing(self, key, idx)) != -1)
+    if ( (tmp = linearProbing(self, key, hash)) != -1)
     {
-        pthread_mutex_lock(&self->fields_lock);
         #ifdef DEBUG
            printf("key already exists in map, update the value\n");
         #endif
-        self->accessCnt++;
-        self->nodes[tmp].accessIdx = self->accessCnt;
+        //an update is not evicted for, the next insert brings the bytes back in budget.
+        self->bytes += val.val_len - self->nodes[tmp].val.val_len;
+        //the map keeps the key it has. the caller's copy of it and the old value
+        //are retired together, a reader may still be sending the old value.
+        map_key_t dup_key = key.key_base != self->nodes[tmp].key.key_base ? key : MAP_KEY(NULL, 0);
+        map_val_t old_val = val.val_base != self->nodes[tmp].val.val_base ? self->nodes[tmp].val : MAP_VAL(NULL, 0);
+        if (dup_key.key_base != NULL || old_val.val_base != NULL)
+            epoch_retire(self->destroy_function, dup_key, old_val);
         self->nodes[tmp].val = val;
+        self->nodes[tmp].cost = opts.cost;
+        self->nodes[tmp].expires = expires;
         self->nodes[tmp].tombstone = false;
-        pthread_mutex_unlock(&self->fields_lock);
+        self->policy->on_hit(self, tmp);
     }
-    //if the map is full, follow LRU replacement policy.
-    else if (self->capacity == self->size && force == true)
+    //insert (key, value) set in an empty slot. skip the slot if it's already used.
+    else
     {
+        size_t need = key.key_len + val.val_len;
 
+        if (force == false && self->max_bytes != 0 && self->bytes + need > self->max_bytes)
+        {
+            errno = ENOMEM;
+            pthread_rwlock_unlock(&self->lock);
+            return false;
+        }
 
-        pthread_mutex_lock(&self->fields_lock);
-        int LRUNodeIdx = 0; // index for Least Recently Used node.
-        for( int i = 1; i < self->capacity ;i++)
+        //while the map is full or over its byte budget, the eviction policy picks a
+        //victim and takes it off its lists. the victim's slot is freed like a
+        //deleted one and the new key is inserted normally.
+        while (self->size > 0 && (self->max_entries == self->size
+            || (self->max_bytes != 0 && self->bytes + need > self->max_bytes)))
         {
-            if(self->nodes[i].accessIdx < self->nodes[LRUNodeIdx].accessIdx)
-                LRUNodeIdx = i;
+            int victim = self->policy->choose_victim(self, hash);
+            #ifdef DEBUG
+              printf("map is full, follow %s replacement policy.\n", self->policy->name);
+            #endif
+            epoch_retire(self->destroy_function, self->nodes[victim].key, self->nodes[victim].val);
+            self->bytes -= self->nodes[victim].key.key_len + self->nodes[victim].val.val_len;
+            removeSlot(self, victim);
+            self->size--;
         }
-        idx = LRUNodeIdx;
-        #ifdef DEBUG
-          printf("map is full, follow LRU replacement policy.\n");
-        #endif
-        self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
-        self->nodes[idx].key.key_base = NULL;
-        self->nodes[idx].val.val_base = NULL;
-        self->nodes[idx].key.key_len = 0;
-        self->nodes[idx].val.val_len = 0;
-        self->nodes[idx].key = key;
-        self->nodes[idx].val = val;
-        self->accessCnt++;
-        self->nodes[idx].accessIdx = self->accessCnt;
-        pthread_mutex_unlock(&self->fields_lock);
-    }
-    //insert (key, value) set in empty or tombstone. skip the slot if it's already used.
-    else
-    {
+
         while(1)
         {
-            //tombstone flag is true, insert (key, value) set.
-            if (self->nodes[idx].tombstone == true)
-            {
-                pthread_mutex_lock(&self->fields_lock);
-                #ifdef DEBUG
-                 // printf("tombstone flag is true, insert (key, value) set.\n");
-                  //  printf("key : %d\n", *((int *)key.key_base));
-                #endif
-                self->accessCnt++;
-                self->nodes[idx].accessIdx = self->accessCnt;
-                self->nodes[idx].key = key;
-                self->nodes[idx].val = val;
-                self->nodes[idx].tombstone = false;
-                self->size++;
-                pthread_mutex_unlock(&self->fields_lock);
-                break;
-            }
-            //or when element in array is empty, insert (key, value) set.
-            else if ( self->nodes[idx].key.key_base == NULL)
+            //when element in array is empty, insert (key, value) set.
+            if ( self->nodes[idx].key.key_base == NULL)
             {
 
-                pthread_mutex_lock(&self->fields_lock);
                 #ifdef DEBUG
                     //printf("when element in array is empty, insert (key, value) set.\n");
                    // printf("key : %d\n", *((int *)key.key_base));
                 #endif
-                self->accessCnt++;
-                self->nodes[idx].accessIdx = self->accessCnt;
                 self->nodes[idx].key = key;
                 self->nodes[idx].val = val;
+                self->nodes[idx].hash = hash;
+                self->nodes[idx].cost = opts.cost;
+                self->nodes[idx].expires = expires;
                 self->nodes[idx].tombstone = false;
+                self->policy->on_insert(self, idx);
                 self->size++;
-                pthread_mutex_unlock(&self->fields_lock);
+                self->bytes += need;
                 break;
             }
 
@@ -242,7 +1049,7 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
 
 
 
-    pthread_mutex_unlock(&self->write_lock);
+    pthread_rwlock_unlock(&self->lock);
     #ifdef DEBUG
        printf("insert (%s,%s) into %dth slot in map (map_size : %d)\n\n",
          (char *)key.key_base, (char *)val.val_base, idx, self->size);
@@ -255,37 +1062,40 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
 
 map_val_t get(hashmap_t *self, map_key_t key) {
 
-    pthread_mutex_lock(&self->fields_lock);
-    self->num_readers++;
-    if(self->num_readers == 1) //first in
-       pthread_mutex_lock(&self->write_lock);
-    pthread_mutex_unlock(&self->fields_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return MAP_VAL(NULL, 0);
+    }
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return get(get_shard(self, key), key);
+    }
+
+    pthread_rwlock_rdlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || key.key_base == NULL || self->invalid == true)
+    if (key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_VAL(NULL, 0);
     }
 
-    int idx = get_index(self, key); //get an index from key.
+    int idx;
 
-    //Retrieve the value associated with a key
-    if ( (idx = linearProbing(self, key, idx)) != -1)
+    //Retrieve the value associated with a key, unless it has expired
+    if ( (idx = linearProbing(self, key, self->hash_function(key))) != -1
+        && !expired(self->nodes[idx].expires))
     {
-        pthread_mutex_lock(&self->fields_lock);
-        self->accessCnt++;
-        self->nodes[idx].accessIdx = self->accessCnt;
-        self->num_readers--;
-        if(self->num_readers == 0) //last out
-            pthread_mutex_unlock(&self->write_lock);
-        pthread_mutex_unlock(&self->fields_lock);
+        self->policy->on_hit(self, idx);
+        map_val_t val = self->nodes[idx].val;
+        pthread_rwlock_unlock(&self->lock);
 
         #ifdef DEBUG
         print_map_info(self);
         #endif
-        return self->nodes[idx].val;
+        return val;
     }
     //if key is not found in the map, the map_val_t instance will contain
     //a NULL pointer and a val_len of 0
@@ -294,66 +1104,98 @@ map_val_t get(hashmap_t *self, map_key_t key) {
         #ifdef DEBUG
             printf("key : %s doesn't exit in map\n", (char*)key.key_base);
         #endif
-        pthread_mutex_lock(&self->fields_lock);
-        self->num_readers--;
-        if(self->num_readers == 0) //last out
-            pthread_mutex_unlock(&self->write_lock);
-        pthread_mutex_unlock(&self->fields_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_VAL(NULL, 0);
     }
 
 }
 
-map_node_t delete(hashmap_t *self, map_key_t key) {
+//delete() and delete_expired(), the latter only removes an expired entry.
+static map_node_t removeKey(hashmap_t *self, map_key_t key, bool expired_only)
+{
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return removeKey(get_shard(self, key), key, expired_only);
+    }
 
-    pthread_mutex_lock(&self->write_lock);
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || key.key_base == NULL || self->invalid == true)
+    if (key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
     }
 
-    int idx = get_index(self, key); //get an index from key.
+    int idx;
 
     //Retrieve the value associated with a key
-    if ( (idx = linearProbing(self, key, idx)) != -1)
+    if ( (idx = linearProbing(self, key, self->hash_function(key))) != -1
+        && (expired_only == false || expired(self->nodes[idx].expires)))
     {
 
-        pthread_mutex_lock(&self->fields_lock);
-        self->nodes[idx].tombstone = true;
-        self->nodes[idx].accessIdx = INF;
+        //the caller owns the removed entry.
+        map_node_t node = self->nodes[idx];
+        self->policy->on_delete(self, idx);
+        removeSlot(self, idx);
         self->size--;
-        pthread_mutex_unlock(&self->fields_lock);
+        self->bytes -= node.key.key_len + node.val.val_len;
         #ifdef DEBUG
             printf("delete map[%d] where key %s is saved. (current size : %d)\n\n",
              idx, (char *)key.key_base, self->size);
             print_map_info(self);
         #endif
 
-        pthread_mutex_unlock(&self->write_lock);
-        return self->nodes[idx];
+        pthread_rwlock_unlock(&self->lock);
+        return node;
     }
     //if key is not found in the map
     else
     {
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
     }
 
 }
 
+map_node_t delete(hashmap_t *self, map_key_t key) {
+    return removeKey(self, key, false);
+}
+
+map_node_t delete_expired(hashmap_t *self, map_key_t key) {
+    return removeKey(self, key, true);
+}
+
 bool clear_map(hashmap_t *self) {
 
-    pthread_mutex_lock(&self->write_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    else if (self->shards != NULL)
+    {
+        pthread_rwlock_rdlock(&self->lock);
+        bool success = !self->invalid;
+        pthread_rwlock_unlock(&self->lock);
+        for (int i = 0; i < self->num_shards; i++)
+            success = clear_map(&self->shards[i]) && success;
+        return success;
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || self->invalid == true)
+    if (self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
@@ -368,45 +1210,67 @@ bool clear_map(hashmap_t *self) {
         {
             if (self->size == 0)
                 continue;
-            pthread_mutex_lock(&self->fields_lock);
-            self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
-            self->nodes[idx].key.key_base = NULL;
+            epoch_retire(self->destroy_function, self->nodes[idx].key, self->nodes[idx].val);
             self->nodes[idx].key.key_base = NULL;
+            self->nodes[idx].val.val_base = NULL;
             self->nodes[idx].key.key_len = 0;
             self->nodes[idx].val.val_len = 0;
             self->nodes[idx].tombstone = false;
-            self->nodes[idx].accessIdx = INF;
             self->size--;
             #ifdef DEBUG
                 printf("clear the map[%d] (current size : %d)\n", idx, self->size);
             #endif
-            pthread_mutex_unlock(&self->fields_lock);
         }
     }
     self->size = 0; //just in case.
-    self->accessCnt = 0;
+    self->bytes = 0;
+    resetPolicy(self);
 
     #ifdef DEBUG
         print_map_info(self);
     #endif
 
 
-    pthread_mutex_unlock(&self->write_lock);
+    pthread_rwlock_unlock(&self->lock);
     return true;
 }
 
 bool invalidate_map(hashmap_t *self) {
 
-    pthread_mutex_unlock(&self->write_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    else if (self->shards != NULL)
+    {
+        //the top level lock only guards its own flag, the shards lock themselves.
+        pthread_rwlock_wrlock(&self->lock);
+        if (self->invalid == true)
+        {
+            errno = EINVAL;
+            pthread_rwlock_unlock(&self->lock);
+            return false;
+        }
+        self->invalid = true;
+        pthread_rwlock_unlock(&self->lock);
+        for (int i = 0; i < self->num_shards; i++)
+            invalidate_map(&self->shards[i]);
+        return true;
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || self->invalid == true)
+    if (self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
+    //a GET may still be sending a value it got before the lock was taken, so
+    //the entries are retired like clear_map() does, and the arrays with them.
     for( int idx = 0; idx < self->capacity ; idx++)
     {
         if(self->nodes[idx].key.key_base == NULL) //if slot is empty
@@ -414,19 +1278,27 @@ bool invalidate_map(hashmap_t *self) {
             continue;
         }
 
-
-        pthread_mutex_lock(&self->fields_lock);
-        self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
+        epoch_retire(self->destroy_function, self->nodes[idx].key, self->nodes[idx].val);
         self->nodes[idx].tombstone = false;
         self->size--;
-        pthread_mutex_unlock(&self->fields_lock);
     }
 
-    pthread_mutex_lock(&self->fields_lock);
     self->invalid = true; //it sets the invalid flag in self to true.
-    free(self->nodes); //it frees the nodes pointer in self.
-    pthread_mutex_unlock(&self->fields_lock);
-
-    pthread_mutex_unlock(&self->write_lock);
-    return false;
+    if (self->huge_pages == false)
+        epoch_free(self->nodes); //it frees the nodes pointer in self.
+    else if (self->nodes != NULL)
+        epoch_retire(hugeDestructor, MAP_KEY(self->nodes, (size_t)self->capacity * sizeof(map_node_t)), MAP_VAL(NULL, 0));
+    epoch_free(self->sketch);
+    epoch_free(self->ghost_nodes);
+    epoch_free(self->ghost_index);
+    epoch_free(self->heap);
+    self->nodes = NULL;
+    self->sketch = NULL;
+    self->ghost_nodes = NULL;
+    self->ghost_index = NULL;
+    self->heap = NULL;
+    self->bytes = 0;
+
+    pthread_rwlock_unlock(&self->lock);
+    return true;
 }
@@ -0,0 +1,204 @@
+#include "hash.h"
+#include <string.h>
+#include <sys/random.h> //getrandom
+
+#define SIP_C_ROUNDS 1 // rounds per 8 byte word
+#define SIP_D_ROUNDS 3 // rounds at the end
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+//the process key of the keyed hashes, written once before any map exists.
+static uint64_t hash_key[2];
+
+//the default secret of wyhash, four odd 64 bit constants with 32 bits set each.
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+//multiplies two words and folds the 128 bit product onto itself.
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+//unaligned little endian loads, compiled to a single mov.
+static inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//keys of 1 to 3 bytes, the middle byte doubles up for 1 and 2.
+static inline uint64_t wyr3(const uint8_t *p, size_t len)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = key;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+    if (len <= 16)
+    {
+        //two overlapping reads from each end cover 4 to 16 bytes without a loop.
+        if (len >= 4)
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wyr3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t left = len;
+
+        //three independent lanes keep the multipliers busy on long keys.
+        if (left > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (left > 16)
+        {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        //the last 16 bytes, overlapping what was mixed already.
+        a = wyr8(p + left - 16);
+        b = wyr8(p + left - 8);
+    }
+
+    __uint128_t r = (__uint128_t)(a ^ wyp[1]) * (b ^ seed);
+    return wymix((uint64_t)r ^ wyp[0] ^ len, (uint64_t)(r >> 64) ^ wyp[1]);
+}
+
+bool hash_seed_random(void)
+{
+    uint64_t key[2];
+
+    if (getrandom(key, sizeof(key), 0) != sizeof(key))
+        return false;
+    hash_seed(key);
+    return true;
+}
+
+void hash_seed(const uint64_t key[2])
+{
+    hash_key[0] = key[0];
+    hash_key[1] = key[1];
+}
+
+static inline void sipRound(uint64_t *v0, uint64_t *v1, uint64_t *v2, uint64_t *v3)
+{
+    *v0 += *v1;
+    *v1 = ROTL(*v1, 13);
+    *v1 ^= *v0;
+    *v0 = ROTL(*v0, 32);
+    *v2 += *v3;
+    *v3 = ROTL(*v3, 16);
+    *v3 ^= *v2;
+    *v0 += *v3;
+    *v3 = ROTL(*v3, 21);
+    *v3 ^= *v0;
+    *v2 += *v1;
+    *v1 = ROTL(*v1, 17);
+    *v1 ^= *v2;
+    *v2 = ROTL(*v2, 32);
+}
+
+uint64_t siphash(const void *data, size_t len, const uint64_t key[2])
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + (len & ~(size_t)7);
+    uint64_t v0 = 0x736f6d6570736575ull ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dull ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ull ^ key[0];
+    uint64_t v3 = 0x7465646279746573ull ^ key[1];
+    uint64_t last = (uint64_t)len << 56;
+
+    for (; p != end; p += 8)
+    {
+        uint64_t m = wyr8(p);
+
+        v3 ^= m;
+        for (int i = 0; i < SIP_C_ROUNDS; i++)
+            sipRound(&v0, &v1, &v2, &v3);
+        v0 ^= m;
+    }
+
+    //the last word holds the 0 to 7 remaining bytes and the length.
+    switch (len & 7)
+    {
+        case 7: last |= (uint64_t)p[6] << 48; // fall through
+        case 6: last |= (uint64_t)p[5] << 40; // fall through
+        case 5: last |= (uint64_t)p[4] << 32; // fall through
+        case 4: last |= (uint64_t)p[3] << 24; // fall through
+        case 3: last |= (uint64_t)p[2] << 16; // fall through
+        case 2: last |= (uint64_t)p[1] << 8; // fall through
+        case 1: last |= (uint64_t)p[0];
+    }
+    v3 ^= last;
+    for (int i = 0; i < SIP_C_ROUNDS; i++)
+        sipRound(&v0, &v1, &v2, &v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < SIP_D_ROUNDS; i++)
+        sipRound(&v0, &v1, &v2, &v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint32_t siphash_hash(map_key_t map_key)
+{
+    uint64_t hash = siphash(map_key.key_base, map_key.key_len, hash_key);
+
+    //see wyhash_hash().
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint32_t wyhash_hash(map_key_t map_key)
+{
+    uint64_t hash = wyhash(map_key.key_base, map_key.key_len, hash_key[0]);
+
+    //the shards use the high bits of the 32 bit hash and the slots the low
+    //ones, both have to see all 64.
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+hash_func_f find_hash(const char *name)
+{
+    if (name == NULL || strcmp(name, "siphash") == 0)
+        return siphash_hash;
+    else if (strcmp(name, "wyhash") == 0)
+        return wyhash_hash;
+    else if (strcmp(name, "jenkins") == 0)
+        return jenkins_one_at_a_time_hash;
+    return NULL;
+}
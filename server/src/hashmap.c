@@ -1,12 +1,63 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
 #include "utils.h"
+#include "epoch.h"
+#include "hugepage.h"
+#include "wheel.h" // wheel_now_ms
 #include <errno.h>
 #include <stdio.h>
 #include <string.h> // memcmp
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define OPTIMISTIC_RETRIES 8 // lock-free get() attempts before falling back to the lock
+#define MIN_TABLE_SIZE 16 // slots a growable map starts with and never shrinks below
+#define MIGRATE_BATCH 8 // old slots every write moves to the new table while resizing
+#define PROBE_ALARM 64 // slots a lookup may visit before it counts as a probe alarm
+
+//swiss table control bytes, a full slot holds the low 7 bits of its hash.
+#define GROUP_SIZE 16 // control bytes scanned at once
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+//bytes of the small keys and values an inline map keeps next to each slot.
+typedef struct map_inline_t {
+    char key[INLINE_KEY_SIZE];
+    char val[INLINE_VAL_SIZE];
+} map_inline_t;
+
+//key_base/val_base of a part stored in the slot's map_inline_t.
+static char inline_base;
+#define INLINE_BASE ((void *)&inline_base)
+
+//get() hands out inline values through a copy, a slot can be reused as soon as the lock is dropped.
+static __thread char inline_val[INLINE_VAL_SIZE];
+
+//a view of one node array, the current table or the one being migrated.
+typedef struct map_table_t {
+    map_node_t *nodes;
+    uint8_t *ctrl; // control bytes in swiss table mode, NULL otherwise
+    map_inline_t *data; // inline keys and values in inline mode, NULL otherwise
+    uint32_t capacity;
+    bool robin_hood;
+} map_table_t;
 
 void print_map_info(hashmap_t * self){
+    if (self->shards != NULL)
+    {
+        for (int i = 0; i < self->num_shards; i++)
+        {
+            printf("\n********\tshard %d\t********", i);
+            print_map_info(&self->shards[i]);
+        }
+        return;
+    }
+
     printf("\n********\tCurrent map info\t********\n");
     printf("map capacity : %d\n", self->capacity);
     printf("map size : %d\n", self->size);
+    if (self->old_nodes != NULL)
+        printf("resizing, old slots left : %d\n", self->old_capacity - self->migrate_idx);
     for (int i =0; i < self->capacity ;i++)
     {
 
@@ -15,38 +66,219 @@ void print_map_info(hashmap_t * self){
         else if (self->nodes[i].key.key_base == NULL)
             printf("map[%d] : empty\n",i );
         else
-            printf("map[%d] : (%s,%s)\n", i,(char*)self->nodes[i].key.key_base,
-                (char*)self->nodes[i].val.val_base);
+            printf("map[%d] : (%s,%s)\n", i,
+                self->nodes[i].key.key_base == INLINE_BASE ? self->inline_data[i].key : (char*)self->nodes[i].key.key_base,
+                self->nodes[i].val.val_base == INLINE_BASE ? self->inline_data[i].val : (char*)self->nodes[i].val.val_base);
     }
     printf("*************************************************\n\n");
 }
 
 
+//swiss tables are made of whole groups, a power of two table is masked.
+static uint32_t tableSize(hashmap_t *self, uint64_t slots)
+{
+    if (self->pow2_capacity == true && slots > 0)
+    {
+        uint64_t pow2 = GROUP_SIZE;
+        while (pow2 < slots)
+            pow2 <<= 1;
+        return pow2 < UINT32_MAX ? pow2 : 1u << 31;
+    }
+    if (self->swiss_table == true)
+        slots = (slots + GROUP_SIZE - 1) / GROUP_SIZE * GROUP_SIZE;
+    return slots;
+}
+
+//the slot a hash starts probing at. a power of two capacity, which tableSize()
+//always gives with pow2_capacity, takes a mask instead of an integer division.
+static inline uint32_t homeSlot(uint32_t hash, uint32_t capacity)
+{
+    return (capacity & (capacity - 1)) == 0 ? hash & (capacity - 1) : hash % capacity;
+}
+
+//the node and inline arrays come from calloc(), or from huge_alloc() with huge_pages.
+static void *allocArray(hashmap_t *self, uint32_t count, size_t size)
+{
+    return self->huge_pages == true ? huge_alloc((size_t)count * size) : calloc(count, size);
+}
+
+static void freeArray(hashmap_t *self, void *array, uint32_t count, size_t size)
+{
+    if (self->huge_pages == true)
+        huge_free(array, (size_t)count * size);
+    else
+        free(array);
+}
+
+static void hugeDestructor(map_key_t key, map_val_t val)
+{
+    huge_free(key.key_base, key.key_len);
+}
+
+//like freeArray(), once lock-free readers are done with the array.
+static void retireArray(hashmap_t *self, void *array, uint32_t count, size_t size)
+{
+    if (self->huge_pages == false)
+        epoch_free(array);
+    else if (array != NULL)
+        epoch_retire(hugeDestructor, MAP_KEY(array, (size_t)count * size), MAP_VAL(NULL, 0));
+}
+
+//allocates an empty table, its control bytes in swiss table mode and its
+//inline area in inline mode.
+static bool allocTable(hashmap_t *self, uint32_t capacity, map_node_t **nodes, uint8_t **ctrl,
+                       map_inline_t **data)
+{
+    *ctrl = NULL;
+    *data = NULL;
+    if ((*nodes = allocArray(self, capacity, sizeof(map_node_t))) == NULL)
+        return false;
+
+    if (self->inline_entries == true && (*data = allocArray(self, capacity, sizeof(map_inline_t))) == NULL)
+    {
+        freeArray(self, *nodes, capacity, sizeof(map_node_t));
+        return false;
+    }
+
+    //groups are loaded with aligned 16 byte loads.
+    if (self->swiss_table == true)
+    {
+        if (posix_memalign((void **)ctrl, GROUP_SIZE, capacity) != 0)
+        {
+            freeArray(self, *nodes, capacity, sizeof(map_node_t));
+            freeArray(self, *data, capacity, sizeof(map_inline_t));
+            return false;
+        }
+        memset(*ctrl, CTRL_EMPTY, capacity);
+    }
+    return true;
+}
+
+//frees the tables of a map that never held an entry, when create_map_opts() gives up.
+static void freeTable(hashmap_t *self)
+{
+    freeArray(self, self->nodes, self->capacity, sizeof(map_node_t));
+    freeArray(self, self->inline_data, self->capacity, sizeof(map_inline_t));
+    free(self->ctrl);
+}
+
+//false if there is no memory for the table.
+static bool init_map(hashmap_t *hashmap, uint32_t capacity, hash_func_f hash_function,
+                     destructor_f destroy_function, map_opts_t opts)
+{
+    //a growable map starts small and resizes itself as entries come and go.
+    hashmap->max_entries = capacity;
+    hashmap->growable = opts.growable == true && capacity > MIN_TABLE_SIZE;
+    hashmap->swiss_table = opts.swiss_table;
+    hashmap->inline_entries = opts.inline_entries;
+    hashmap->pow2_capacity = opts.pow2_capacity;
+    hashmap->huge_pages = opts.huge_pages;
+    hashmap->capacity = tableSize(hashmap, hashmap->growable == true ? MIN_TABLE_SIZE : capacity);
+    hashmap->size = 0;
+    //make an array. the top level map of a sharded one has no slots.
+    if (!allocTable(hashmap, hashmap->capacity, &hashmap->nodes, &hashmap->ctrl, &hashmap->inline_data)
+        && hashmap->capacity > 0)
+    {
+        return false;
+    }
+    hashmap->old_nodes = NULL;
+    hashmap->old_ctrl = NULL;
+    hashmap->old_inline_data = NULL;
+    hashmap->old_capacity = 0;
+    hashmap->migrate_idx = 0;
+    hashmap->hash_function = hash_function;
+    hashmap->destroy_function = destroy_function;
+
+    //writers are preferred so a steady stream of readers can never starve put()/delete().
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&hashmap->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    hashmap->invalid = false;
+    hashmap->seq = 0;
+    hashmap->probe_alarms = 0;
+    hashmap->bytes = 0;
+    hashmap->optimistic_get = opts.optimistic_get;
+    //control bytes replace robin hood's probe distances.
+    hashmap->robin_hood = opts.robin_hood == true && opts.swiss_table == false;
+    hashmap->num_shards = 0;
+    hashmap->shards = NULL;
+    return true;
+}
+
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
+    return create_map_opts(capacity, hash_function, destroy_function, (map_opts_t) {.num_shards = 1});
+}
 
-    if (hash_function == NULL || destroy_function == NULL)
+hashmap_t *create_map_opts(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function,
+                           map_opts_t opts) {
+
+    //the eviction policies and the byte budget live in the extra credit map.
+    //refusing them here keeps a deployment that asks for one from running an
+    //unbounded map instead. a growable map allocates its tables under the
+    //write lock, where mapping and faulting in huge pages stalls every writer.
+    if (hash_function == NULL || destroy_function == NULL || opts.num_shards > capacity
+        || opts.eviction != NULL || opts.max_bytes != 0 || (opts.huge_pages == true && opts.growable == true))
     {
         errno = EINVAL;
         return NULL;
     }
 
-    hashmap_t * hashmap = (hashmap_t *)calloc(1, sizeof(hashmap_t));
+    hashmap_t * hashmap;
 
-    if (hashmap == NULL)
+    if (posix_memalign((void **)&hashmap, __alignof__(hashmap_t), sizeof(hashmap_t)) != 0)
     {
+        errno = ENOMEM;
         return NULL;
     }
+    memset(hashmap, 0, sizeof(hashmap_t));
 
-    hashmap->capacity = capacity;
-    hashmap->size = 0;
-    hashmap->nodes = (map_node_t *)calloc(capacity, sizeof(map_node_t)); //make an array.
-    hashmap->hash_function = hash_function;
-    hashmap->destroy_function = destroy_function;
-    hashmap->num_readers = 0;
+    if (opts.num_shards <= 1)
+    {
+        //a table of several GB may not be there, from huge pages or at all.
+        if (!init_map(hashmap, capacity, hash_function, destroy_function, opts))
+        {
+            free(hashmap);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    else
+    {
+        //the top level map only routes keys, every shard is a complete map of its own.
+        init_map(hashmap, 0, hash_function, destroy_function, opts);
+        hashmap->capacity = capacity;
+        hashmap->max_entries = capacity;
 
-    pthread_mutex_init(&hashmap->write_lock, NULL);
-    pthread_mutex_init(&hashmap->fields_lock, NULL);
-    hashmap->invalid = false;
+        if (posix_memalign((void **)&hashmap->shards, __alignof__(hashmap_t),
+            opts.num_shards * sizeof(hashmap_t)) != 0)
+        {
+            freeTable(hashmap);
+            free(hashmap);
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(hashmap->shards, 0, opts.num_shards * sizeof(hashmap_t));
+        hashmap->num_shards = opts.num_shards;
+
+        //spread the capacity evenly, the first shards take the remainder. the
+        //shards built before one that gets no memory are freed again.
+        for (int i = 0; i < opts.num_shards; i++)
+        {
+            if (!init_map(&hashmap->shards[i], capacity / opts.num_shards + (i < capacity % opts.num_shards),
+                hash_function, destroy_function, opts))
+            {
+                while (i-- > 0)
+                    freeTable(&hashmap->shards[i]);
+                free(hashmap->shards);
+                freeTable(hashmap);
+                free(hashmap);
+                errno = ENOMEM;
+                return NULL;
+            }
+        }
+    }
 
     #ifdef DEBUG
         printf("initialized the map!\n");
@@ -55,19 +287,77 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
     return hashmap;
 }
 
+//true if a writer has touched the map since an optimistic reader sampled seq.
+static inline bool seq_read_retry(hashmap_t *self, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&self->seq, __ATOMIC_RELAXED) != seq;
+}
+
+//writers make seq odd while they modify the nodes, see get().
+static inline void seq_write_begin(hashmap_t *self)
+{
+    __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(hashmap_t *self)
+{
+    __atomic_store_n(&self->seq, self->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline map_table_t currentTable(hashmap_t *self)
+{
+    return (map_table_t) {.nodes = self->nodes, .ctrl = self->ctrl, .data = self->inline_data,
+        .capacity = self->capacity, .robin_hood = self->robin_hood};
+}
+
+//the old table fills up with tombstones while it is migrated, which breaks
+//robin hood's ordering, so its early exit is off. otherwise the probe keeps
+//the table's layout: a swiss table is still probed group by group.
+static inline map_table_t oldTable(hashmap_t *self)
+{
+    return (map_table_t) {.nodes = self->old_nodes, .ctrl = self->old_ctrl, .data = self->old_inline_data,
+        .capacity = self->old_capacity, .robin_hood = false};
+}
+
+//the bytes of the key stored at idx, wherever they live.
+static inline const void *keyBytes(map_table_t table, int idx, const map_node_t *node)
+{
+    return node->key.key_base == INLINE_BASE ? table.data[idx].key : node->key.key_base;
+}
+
+//a chain this long should not happen with a keyed hash at the load factors
+//the map runs at, so it hints at keys crafted against the hash function.
+static void probeAlarm(hashmap_t *self)
+{
+    __atomic_fetch_add(&self->probe_alarms, 1, __ATOMIC_RELAXED);
+    #ifdef DEBUG
+        printf("probe alarm: a lookup visited %d slots\n", PROBE_ALARM);
+    #endif
+}
+
 //return -1 if key doesn't exist on Map
-int linearProbing(hashmap_t *self, map_key_t key, int idx)
+//lock-free readers pass the sequence number they started from, and get -2 back
+//as soon as a writer has touched the map, before any stale key is dereferenced.
+int linearProbing(hashmap_t *self, map_table_t table, map_key_t key, uint32_t hash, const uint32_t *seq)
 {
     #ifdef DEBUG
            printf("linearProbling function is called\n");
     #endif
 
+    int idx = homeSlot(hash, table.capacity);
     int movCnt = 0;
     while(1)
     {
+        map_node_t node = table.nodes[idx];
+
+        if (movCnt == PROBE_ALARM)
+            probeAlarm(self);
+
         //if couldn't find target key after searching all elements
         //in full map, make decision that key doest not exist!
-        if (movCnt == self->capacity)
+        if (movCnt == table.capacity)
         {
             #ifdef DEBUG
             printf("result : key does not exist!\n");
@@ -75,10 +365,10 @@ int linearProbing(hashmap_t *self, map_key_t key, int idx)
             return -1;
         }
         //skip over a tombstone
-        else if (self->nodes[idx].tombstone == true)
+        else if (node.tombstone == true)
         {
             idx++; //linear probing
-            if(idx == self->capacity)
+            if(idx == table.capacity)
                 idx = 0;
             movCnt++;
             #ifdef DEBUG
@@ -88,144 +378,545 @@ int linearProbing(hashmap_t *self, map_key_t key, int idx)
             continue;
         }
         //1)when slot is empty make decision that key doest not exist!
-        else if (self->nodes[idx].key.key_base == NULL)
+        else if (node.key.key_base == NULL)
         {
             #ifdef DEBUG
             printf("result : key does not exist!\n");
             #endif
             return -1;
         }
-        else if ( self->nodes[idx].key.key_base != NULL
-            && memcmp(self->nodes[idx].key.key_base, key.key_base, key.key_len) == 0
-            && memcmp(self->nodes[idx].key.key_base, key.key_base, self->nodes[idx].key.key_len) == 0
-            && self->nodes[idx].tombstone == false)
+        //2)robin hood keeps clusters sorted by probe length, an entry closer to its
+        //home than we are to ours means the key would have been placed before it.
+        else if (table.robin_hood == true && node.dist < movCnt)
+        {
+            return -1;
+        }
+        //3)the cached hash and length rule out other keys without touching their bytes.
+        else if (node.hash == hash && node.key.key_len == key.key_len)
+        {
+            if (seq != NULL && seq_read_retry(self, *seq))
+            {
+                return -2;
+            }
+            else if (memcmp(keyBytes(table, idx, &node), key.key_base, key.key_len) == 0)
+            {
+                #ifdef DEBUG
+                printf("result : key exists!\n");
+                #endif
+                return idx;
+            }
+        }
+
+        idx++; //skip nonempty slot.
+        if(idx == table.capacity)
+            idx = 0;
+        movCnt++;
+    }
+}
+
+static inline uint32_t homeGroup(uint32_t hash, uint32_t capacity)
+{
+    //the low 7 bits go to the control byte, the group comes from the rest.
+    return homeSlot(hash >> 7, capacity / GROUP_SIZE);
+}
+
+//bit i is set if control byte i of the group equals ctrl.
+static inline uint32_t groupMatch(const uint8_t *group, uint8_t ctrl)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_load_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++)
+        mask |= (uint32_t)(group[i] == ctrl) << i;
+    return mask;
+#endif
+}
+
+//bit i is set if slot i of the group is empty or deleted.
+static inline uint32_t groupFree(const uint8_t *group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++)
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+//swiss table lookup: a whole group of control bytes is compared against the
+//hash tag at once, and only the nodes whose tag matches are looked at. the
+//search ends at the first group with an empty slot. same results as linearProbing().
+int groupProbing(hashmap_t *self, map_table_t table, map_key_t key, uint32_t hash, const uint32_t *seq)
+{
+    uint32_t num_groups = table.capacity / GROUP_SIZE;
+    uint32_t group = homeGroup(hash, table.capacity);
+
+    for (int n = 0; n < num_groups; n++)
+    {
+        const uint8_t *ctrl = &table.ctrl[group * GROUP_SIZE];
+        uint32_t match = groupMatch(ctrl, hash & 0x7F);
+
+        if (n == PROBE_ALARM / GROUP_SIZE)
+            probeAlarm(self);
+
+        while (match != 0)
+        {
+            int idx = group * GROUP_SIZE + __builtin_ctz(match);
+            map_node_t node = table.nodes[idx];
+
+            match &= match - 1;
+            if (node.key.key_base == NULL || node.hash != hash || node.key.key_len != key.key_len)
+                continue;
+            else if (seq != NULL && seq_read_retry(self, *seq))
+                return -2;
+            else if (memcmp(keyBytes(table, idx, &node), key.key_base, key.key_len) == 0)
+                return idx;
+        }
+        if (groupMatch(ctrl, CTRL_EMPTY) != 0)
+            return -1;
+
+        if (++group == num_groups)
+            group = 0;
+    }
+    return -1;
+}
+
+static inline int probeTable(hashmap_t *self, map_table_t table, map_key_t key, uint32_t hash,
+                             const uint32_t *seq)
+{
+    if (table.ctrl != NULL)
+        return groupProbing(self, table, key, hash, seq);
+    return linearProbing(self, table, key, hash, seq);
+}
+
+//looks the key up in the current table, then in the one being migrated.
+//table is set to the table the key was found in.
+static int findNode(hashmap_t *self, map_key_t key, uint32_t hash, map_table_t *table)
+{
+    int idx;
+
+    *table = currentTable(self);
+    if ((idx = probeTable(self, *table, key, hash, NULL)) != -1 || self->old_nodes == NULL)
+        return idx;
+
+    *table = oldTable(self);
+    return probeTable(self, *table, key, hash, NULL);
+}
+
+//robin hood insertion, the caller has checked that the key is not in the map
+//and that there is a free slot. an entry sitting closer to its home slot than
+//the one being inserted gives its slot up and moves on instead.
+static void robinHoodInsert(hashmap_t *self, map_node_t node, const map_inline_t *data, int idx)
+{
+    //inline bytes travel with their node.
+    map_inline_t carry;
+    if (self->inline_data != NULL)
+        carry = *data;
+
+    node.dist = 0;
+    while(1)
+    {
+        if (self->nodes[idx].key.key_base == NULL)
+        {
+            self->nodes[idx] = node;
+            if (self->inline_data != NULL)
+                self->inline_data[idx] = carry;
+            self->size++;
+            return;
+        }
+        else if (self->nodes[idx].dist < node.dist)
+        {
+            map_node_t rich = self->nodes[idx];
+            self->nodes[idx] = node;
+            node = rich;
+            if (self->inline_data != NULL)
+            {
+                map_inline_t rich_data = self->inline_data[idx];
+                self->inline_data[idx] = carry;
+                carry = rich_data;
+            }
+        }
+
+        idx++;
+        if(idx == self->capacity)
+            idx = 0;
+        node.dist++;
+    }
+}
+
+//backward shift deletion: every following entry that is not in its home slot
+//moves one slot back, so robin hood maps never need tombstones.
+static void robinHoodRemove(hashmap_t *self, int idx)
+{
+    int next = (idx + 1 == self->capacity) ? 0 : idx + 1;
+
+    while (self->nodes[next].key.key_base != NULL && self->nodes[next].dist > 0)
+    {
+        self->nodes[idx] = self->nodes[next];
+        self->nodes[idx].dist--;
+        if (self->inline_data != NULL)
+            self->inline_data[idx] = self->inline_data[next];
+        idx = next;
+        next = (idx + 1 == self->capacity) ? 0 : idx + 1;
+    }
+    self->nodes[idx] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    self->size--;
+}
+
+//fills a free slot of the current table.
+static inline void storeNode(hashmap_t *self, int idx, map_node_t node, const map_inline_t *data)
+{
+    self->nodes[idx] = node;
+    self->nodes[idx].tombstone = false;
+    if (self->inline_data != NULL)
+        self->inline_data[idx] = *data;
+    self->size++;
+}
+
+//takes the first empty or deleted slot from the home group on.
+static void swissInsert(hashmap_t *self, map_node_t node, const map_inline_t *data, uint32_t hash)
+{
+    uint32_t num_groups = self->capacity / GROUP_SIZE;
+    uint32_t group = homeGroup(hash, self->capacity);
+    uint32_t free_slots;
+
+    while ((free_slots = groupFree(&self->ctrl[group * GROUP_SIZE])) == 0)
+    {
+        if (++group == num_groups)
+            group = 0;
+    }
+
+    int idx = group * GROUP_SIZE + __builtin_ctz(free_slots);
+    storeNode(self, idx, node, data);
+    self->ctrl[idx] = hash & 0x7F;
+}
+
+//a group that still has an empty slot never made a lookup go on to the next
+//group, so the deleted slot can become empty again instead of a tombstone.
+static void swissRemove(hashmap_t *self, map_table_t table, int idx)
+{
+    bool tombstone = groupMatch(&table.ctrl[idx / GROUP_SIZE * GROUP_SIZE], CTRL_EMPTY) == 0;
+
+    table.ctrl[idx] = tombstone == true ? CTRL_DELETED : CTRL_EMPTY;
+    table.nodes[idx] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), tombstone);
+    self->size--;
+}
+
+//inserts a key that is not in the map yet into the current table.
+//data holds the inline parts of the entry in inline mode.
+static void insertNode(hashmap_t *self, map_node_t node, const map_inline_t *data, uint32_t hash)
+{
+    int idx = homeSlot(hash, self->capacity);
+
+    node.hash = hash;
+    if (self->robin_hood == true)
+    {
+        robinHoodInsert(self, node, data, idx);
+        return;
+    }
+    else if (self->ctrl != NULL)
+    {
+        swissInsert(self, node, data, hash);
+        return;
+    }
+
+    //insert (key, value) set in empty or tombstone. skip the slot if it's already used.
+    while(1)
+    {
+        //tombstone flag is true, insert (key, value) set.
+        if (self->nodes[idx].tombstone == true)
+        {
+            #ifdef DEBUG
+             // printf("tombstone flag is true, insert (key, value) set.\n");
+              //  printf("key : %d\n", *((int *)key.key_base));
+            #endif
+            storeNode(self, idx, node, data);
+            return;
+        }
+        //or when element in array is empty, insert (key, value) set.
+        else if ( self->nodes[idx].key.key_base == NULL)
         {
+
             #ifdef DEBUG
-            printf("result : key exists!\n");
+                //printf("when element in array is empty, insert (key, value) set.\n");
+               // printf("key : %d\n", *((int *)key.key_base));
             #endif
-            return idx;
+            storeNode(self, idx, node, data);
+            return;
         }
 
-        idx++; //skip nonempty slot.
+        #ifdef DEBUG
+           printf("%dth slot is already taken, skip this slot\n",idx);
+        #endif
+
+        idx++; //skip the slot if it's already used.
         if(idx == self->capacity)
             idx = 0;
-        movCnt++;
     }
 }
 
+//removes the entry at idx of table, the caller takes care of the entry itself.
+static void removeNode(hashmap_t *self, map_table_t table, int idx)
+{
+    if (table.robin_hood == true)
+    {
+        robinHoodRemove(self, idx);
+        return;
+    }
+    else if (table.ctrl != NULL)
+    {
+        swissRemove(self, table, idx);
+        return;
+    }
 
-bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    table.nodes[idx].tombstone = true;
+    table.nodes[idx].key = MAP_KEY(NULL, 0);
+    table.nodes[idx].val = MAP_VAL(NULL, 0);
+    self->size--;
+}
 
+//in inline mode small keys and values are copied into data and their bases
+//become INLINE_BASE, the caller keeps its own buffers for those parts.
+static map_node_t inlineNode(hashmap_t *self, map_node_t node, map_inline_t *data)
+{
+    if (self->inline_entries == false)
+        return node;
 
-    pthread_mutex_lock(&self->write_lock);
+    if (node.key.key_len <= INLINE_KEY_SIZE)
+    {
+        memcpy(data->key, node.key.key_base, node.key.key_len);
+        node.key.key_base = INLINE_BASE;
+    }
+    if (node.val.val_len <= INLINE_VAL_SIZE)
+    {
+        memcpy(data->val, node.val.val_base, node.val.val_len);
+        node.val.val_base = INLINE_BASE;
+    }
+    return node;
+}
+
+//the parts of an entry the map owns, inline parts come out as NULL.
+static map_node_t ownedNode(map_node_t node)
+{
+    if (node.key.key_base == INLINE_BASE)
+        node.key.key_base = NULL;
+    if (node.val.val_base == INLINE_BASE)
+        node.val.val_base = NULL;
+    return node;
+}
+
+//hands the owned parts of a removed entry to epoch_retire().
+static void retireNode(hashmap_t *self, map_node_t node)
+{
+    node = ownedNode(node);
+    if (node.key.key_base != NULL || node.val.val_base != NULL)
+        epoch_retire(self->destroy_function, node.key, node.val);
+}
+
+//copies an inline value out of the table, see inline_val.
+static inline map_val_t inlineVal(map_table_t table, int idx, map_val_t val)
+{
+    memcpy(inline_val, table.data[idx].val, val.val_len);
+    return MAP_VAL(inline_val, val.val_len);
+}
+
+//picks the entry a forced put() replaces when the map is full: the one at the
+//index the new key hashes to, or the next one after it if that slot is free.
+static int findVictim(hashmap_t *self, uint32_t hash, map_table_t *table)
+{
+    *table = currentTable(self);
+    for (int n = 0, idx = homeSlot(hash, table->capacity); n < table->capacity; n++)
+    {
+        if (table->nodes[idx].key.key_base != NULL && table->nodes[idx].tombstone == false)
+            return idx;
+        idx = (idx + 1 == table->capacity) ? 0 : idx + 1;
+    }
+
+    //everything still lives in the table being migrated.
+    *table = oldTable(self);
+    for (int idx = self->migrate_idx; self->old_nodes != NULL && idx < table->capacity; idx++)
+    {
+        if (table->nodes[idx].key.key_base != NULL && table->nodes[idx].tombstone == false)
+            return idx;
+    }
+    return -1;
+}
+
+//incremental resize: every write moves a few slots of the old table over to the
+//new one, so no single operation pays for rehashing the whole map.
+static void migrateNodes(hashmap_t *self)
+{
+    for (int n = 0; n < MIGRATE_BATCH && self->old_nodes != NULL; n++)
+    {
+        map_node_t *node = &self->old_nodes[self->migrate_idx];
+
+        if (node->key.key_base != NULL && node->tombstone == false)
+        {
+            //the migrated slot becomes a tombstone so probes through the old table go on.
+            map_node_t moved = MAP_NODE(node->key, node->val, false);
+            uint32_t hash = node->hash;
+            removeNode(self, oldTable(self), self->migrate_idx);
+            insertNode(self, moved, self->old_inline_data != NULL
+                ? &self->old_inline_data[self->migrate_idx] : NULL, hash);
+        }
+
+        if (++self->migrate_idx == self->old_capacity)
+        {
+            //lock-free readers may still be probing the old array.
+            retireArray(self, self->old_nodes, self->old_capacity, sizeof(map_node_t));
+            epoch_free(self->old_ctrl);
+            retireArray(self, self->old_inline_data, self->old_capacity, sizeof(map_inline_t));
+            self->old_nodes = NULL;
+            self->old_ctrl = NULL;
+            self->old_inline_data = NULL;
+            self->old_capacity = 0;
+            self->migrate_idx = 0;
+        }
+    }
+}
+
+//starts an incremental resize of a growable map once its load factor leaves
+//[1/8, 3/4]. the table never grows past a third more slots than max_entries.
+static void resizeTable(hashmap_t *self)
+{
+    uint64_t max_capacity = tableSize(self, self->max_entries + self->max_entries / 3 + 1);
+    uint64_t capacity;
+
+    if (self->growable == false || self->old_nodes != NULL)
+        return;
+    else if ((uint64_t)(self->size + 1) * 4 > (uint64_t)self->capacity * 3 && self->capacity < max_capacity)
+        capacity = (uint64_t)self->capacity * 2 < max_capacity ? (uint64_t)self->capacity * 2 : max_capacity;
+    else if ((uint64_t)self->size * 8 < self->capacity && self->capacity / 2 >= MIN_TABLE_SIZE)
+        capacity = self->capacity / 2;
+    else
+        return;
+
+    map_node_t *nodes;
+    uint8_t *ctrl;
+    map_inline_t *data;
+
+    //keep going with the current table, it still has room for the entry.
+    if ((capacity = tableSize(self, capacity)) == self->capacity
+        || !allocTable(self, capacity, &nodes, &ctrl, &data))
+        return;
+
+    #ifdef DEBUG
+        printf("resize the map from %d to %d slots\n", self->capacity, (int)capacity);
+    #endif
+    self->old_nodes = self->nodes;
+    self->old_ctrl = self->ctrl;
+    self->old_inline_data = self->inline_data;
+    self->old_capacity = self->capacity;
+    self->migrate_idx = 0;
+    self->nodes = nodes;
+    self->ctrl = ctrl;
+    self->inline_data = data;
+    self->capacity = capacity;
+}
+
+//an entry whose deadline has passed is gone for get(), the clock is only read
+//for entries that have one.
+static inline bool expired(uint64_t expires)
+{
+    return expires != 0 && expires <= wheel_now_ms();
+}
+
+bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    return put_ext(self, key, val, force, (map_put_opts_t) {.cost = 1});
+}
+
+bool put_ext(hashmap_t *self, map_key_t key, map_val_t val, bool force, map_put_opts_t opts) {
 
     if (self == NULL)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
-
         return false;
     }
-    else if ( val.val_base == NULL || key.key_base == NULL || self->invalid == true)
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return put_ext(get_shard(self, key), key, val, force, opts);
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
+
+    if ( val.val_base == NULL || key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
-    else if (self->capacity == self->size && force == false)
+    else if (self->max_entries == self->size && force == false)
     {
         errno = ENOMEM;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
-    int idx = get_index(self, key); //get an index from key.
-    int tmp;
+    uint32_t hash = self->hash_function(key);
+    map_inline_t data;
+    map_node_t node = inlineNode(self, MAP_NODE(key, val, false), &data);
+    map_table_t table;
+    int idx;
 
+    node.expires = opts.ttl_ms != 0 ? wheel_now_ms() + opts.ttl_ms : 0;
+    seq_write_begin(self);
+    migrateNodes(self);
 
     //if the key already exists in the map, update the value associated with it.
-    if ( (tmp = linearProbing(self, key, idx)) != -1)
+    if ( (idx = findNode(self, key, hash, &table)) != -1)
     {
-        pthread_mutex_lock(&self->fields_lock);
         #ifdef DEBUG
            printf("key already exists in map, update the value\n");
         #endif
-        self->nodes[tmp].val = val;
-        self->nodes[tmp].tombstone = false;
-        pthread_mutex_unlock(&self->fields_lock);
+        //the map keeps the key it has. the caller's copy of it and the old value
+        //are retired together, a reader may still be sending the old value.
+        map_node_t old = ownedNode(MAP_NODE(node.key, table.nodes[idx].val, false));
+        if (old.key.key_base == table.nodes[idx].key.key_base)
+            old.key.key_base = NULL;
+        if (old.val.val_base == node.val.val_base)
+            old.val.val_base = NULL;
+        retireNode(self, old);
+        self->bytes += node.val.val_len - table.nodes[idx].val.val_len;
+        table.nodes[idx].val = node.val;
+        table.nodes[idx].expires = node.expires;
+        if (node.val.val_base == INLINE_BASE)
+            memcpy(table.data[idx].val, data.val, node.val.val_len);
     }
     //if the map is full and force is true, overwrite the entry at the index given by get_index
-    else if (self->capacity == self->size && force == true)
+    else if (self->max_entries == self->size && force == true)
     {
-
-
-        pthread_mutex_lock(&self->fields_lock);
         #ifdef DEBUG
           printf("map is full, overwrite the entry at the index given by get_index\n");
         #endif
-        self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
-        self->nodes[idx].key.key_base = NULL;
-        self->nodes[idx].val.val_base = NULL;
-        self->nodes[idx].key.key_len = 0;
-        self->nodes[idx].val.val_len = 0;
-        self->nodes[idx].key = key;
-        self->nodes[idx].val = val;
-        pthread_mutex_unlock(&self->fields_lock);
+        //the victim is removed and the new key inserted normally, so a robin hood
+        //or resizing map keeps its layout.
+        if ((idx = findVictim(self, hash, &table)) != -1)
+        {
+            self->bytes -= table.nodes[idx].key.key_len + table.nodes[idx].val.val_len;
+            retireNode(self, table.nodes[idx]);
+            removeNode(self, table, idx);
+        }
+        insertNode(self, node, &data, hash);
+        self->bytes += key.key_len + val.val_len;
     }
-    //insert (key, value) set in empty or tombstone. skip the slot if it's already used.
     else
     {
-        while(1)
-        {
-            //tombstone flag is true, insert (key, value) set.
-            if (self->nodes[idx].tombstone == true)
-            {
-                pthread_mutex_lock(&self->fields_lock);
-                #ifdef DEBUG
-                 // printf("tombstone flag is true, insert (key, value) set.\n");
-                  //  printf("key : %d\n", *((int *)key.key_base));
-                #endif
-                self->nodes[idx].key = key;
-                self->nodes[idx].val = val;
-                self->nodes[idx].tombstone = false;
-                self->size++;
-                pthread_mutex_unlock(&self->fields_lock);
-                break;
-            }
-            //or when element in array is empty, insert (key, value) set.
-            else if ( self->nodes[idx].key.key_base == NULL)
-            {
-
-                pthread_mutex_lock(&self->fields_lock);
-                #ifdef DEBUG
-                    //printf("when element in array is empty, insert (key, value) set.\n");
-                   // printf("key : %d\n", *((int *)key.key_base));
-                #endif
-                self->nodes[idx].key = key;
-                self->nodes[idx].val = val;
-                self->nodes[idx].tombstone = false;
-                self->size++;
-                pthread_mutex_unlock(&self->fields_lock);
-                break;
-            }
-
-            #ifdef DEBUG
-               printf("%dth slot is already taken, skip this slot\n",idx);
-            #endif
-
-            idx++; //skip the slot if it's already used.
-            if(idx == self->capacity)
-                idx = 0;
-
-        }
+        resizeTable(self);
+        insertNode(self, node, &data, hash);
+        self->bytes += key.key_len + val.val_len;
     }
 
+    seq_write_end(self);
 
 
-    pthread_mutex_unlock(&self->write_lock);
+    pthread_rwlock_unlock(&self->lock);
     #ifdef DEBUG
-       printf("insert (%s,%s) into %dth slot in map (map_size : %d)\n\n",
-         (char *)key.key_base, (char *)val.val_base, idx, self->size);
+       printf("insert (%s,%s) into map (map_size : %d)\n\n",
+         (char *)key.key_base, (char *)val.val_base, self->size);
        print_map_info(self);
     #endif
 
@@ -235,32 +926,95 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
 
 map_val_t get(hashmap_t *self, map_key_t key) {
 
-    pthread_mutex_lock(&self->fields_lock);
-    self->num_readers++;
-    if(self->num_readers == 1) //first in
-       pthread_mutex_lock(&self->write_lock);
-    pthread_mutex_unlock(&self->fields_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return MAP_VAL(NULL, 0);
+    }
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return get(get_shard(self, key), key);
+    }
+
+    uint32_t hash = key.key_base != NULL ? self->hash_function(key) : 0;
+    map_table_t table;
+    int idx;
+
+    //optimistic path: probe without any lock and retry if a writer intervened.
+    //entries are only destroyed through epoch_retire(), so everything reachable
+    //from the nodes stays valid while we are inside the epoch.
+    if (self->optimistic_get == true && key.key_base != NULL)
+    {
+        epoch_enter();
+        for (int attempt = 0; attempt < OPTIMISTIC_RETRIES; attempt++)
+        {
+            uint32_t seq = __atomic_load_n(&self->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1 || __atomic_load_n(&self->invalid, __ATOMIC_RELAXED) == true) //writer in progress
+                continue;
+
+            //the table pointers and sizes have to belong to the same resize step.
+            map_table_t old = oldTable(self);
+            table = currentTable(self);
+            if (seq_read_retry(self, seq))
+                continue;
+
+            idx = probeTable(self, table, key, hash, &seq);
+            if (idx == -1 && old.nodes != NULL)
+            {
+                table = old;
+                idx = probeTable(self, table, key, hash, &seq);
+            }
+            if (idx == -2)
+                continue;
+
+            map_node_t *node = idx == -1 ? NULL : &table.nodes[idx];
+            map_val_t val = node == NULL ? MAP_VAL(NULL, 0) : node->val;
+            uint64_t expires = node == NULL ? 0 : node->expires;
+            if (seq_read_retry(self, seq))
+                continue;
+
+            //an expired entry stays until the reaper removes it, but is not found.
+            if (expired(expires))
+            {
+                epoch_exit();
+                return MAP_VAL(NULL, 0);
+            }
+
+            //the bytes themselves are only known to be consistent after another check.
+            if (val.val_base == INLINE_BASE)
+            {
+                val = inlineVal(table, idx, val);
+                if (seq_read_retry(self, seq))
+                    continue;
+            }
+
+            epoch_exit();
+            return val;
+        }
+        //too much write traffic, wait for the writers on the lock instead.
+        epoch_exit();
+    }
+
+    pthread_rwlock_rdlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || key.key_base == NULL || self->invalid == true)
+    if (key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_VAL(NULL, 0);
     }
 
-    int idx = get_index(self, key); //get an index from key.
-
-    //Retrieve the value associated with a key
-    if ( (idx = linearProbing(self, key, idx)) != -1)
+    //Retrieve the value associated with a key, unless it has expired
+    if ( (idx = findNode(self, key, hash, &table)) != -1
+        && !expired(table.nodes[idx].expires))
     {
-        pthread_mutex_lock(&self->fields_lock);
-        self->num_readers--;
-        if(self->num_readers == 0) //last out
-            pthread_mutex_unlock(&self->write_lock);
-        pthread_mutex_unlock(&self->fields_lock);
+        map_val_t val = table.nodes[idx].val;
+        if (val.val_base == INLINE_BASE)
+            val = inlineVal(table, idx, val);
+        pthread_rwlock_unlock(&self->lock);
 
-        return self->nodes[idx].val;
+        return val;
     }
     //if key is not found in the map, the map_val_t instance will contain
     //a NULL pointer and a val_len of 0
@@ -269,136 +1023,347 @@ map_val_t get(hashmap_t *self, map_key_t key) {
         #ifdef DEBUG
             printf("key : %s doesn't exit in map\n", (char*)key.key_base);
         #endif
-        pthread_mutex_lock(&self->fields_lock);
-        self->num_readers--;
-        if(self->num_readers == 0) //last out
-            pthread_mutex_unlock(&self->write_lock);
-        pthread_mutex_unlock(&self->fields_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_VAL(NULL, 0);
     }
 
 }
 
-map_node_t delete(hashmap_t *self, map_key_t key) {
+//delete() and delete_expired(), the latter only removes an expired entry.
+static map_node_t removeKey(hashmap_t *self, map_key_t key, bool expired_only)
+{
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
+    else if (self->shards != NULL && key.key_base != NULL)
+    {
+        return removeKey(get_shard(self, key), key, expired_only);
+    }
 
-    pthread_mutex_lock(&self->write_lock);
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || key.key_base == NULL || self->invalid == true)
+    if (key.key_base == NULL || self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
     }
 
-    int idx = get_index(self, key); //get an index from key.
+    map_node_t node = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    map_table_t table;
+    int idx;
+
+    seq_write_begin(self);
+    migrateNodes(self);
 
     //Retrieve the value associated with a key
-    if ( (idx = linearProbing(self, key, idx)) != -1)
+    if ( (idx = findNode(self, key, self->hash_function(key), &table)) != -1
+        && (expired_only == false || expired(table.nodes[idx].expires)))
     {
-
-        pthread_mutex_lock(&self->fields_lock);
-        self->nodes[idx].tombstone = true;
-        self->size--;
-        pthread_mutex_unlock(&self->fields_lock);
+        //the caller owns the removed entry, the slot is emptied or keeps its tombstone.
+        node = ownedNode(table.nodes[idx]);
+        self->bytes -= node.key.key_len + node.val.val_len;
+        removeNode(self, table, idx);
+        resizeTable(self);
         #ifdef DEBUG
             printf("delete map[%d] where key %s is saved. (current size : %d)\n\n",
              idx, (char *)key.key_base, self->size);
             print_map_info(self);
         #endif
-
-        pthread_mutex_unlock(&self->write_lock);
-        return self->nodes[idx];
     }
-    //if key is not found in the map
-    else
+
+    seq_write_end(self);
+    pthread_rwlock_unlock(&self->lock);
+    return node;
+}
+
+map_node_t delete(hashmap_t *self, map_key_t key) {
+    return removeKey(self, key, false);
+}
+
+map_node_t delete_expired(hashmap_t *self, map_key_t key) {
+    return removeKey(self, key, true);
+}
+
+//destroys every entry of a table, through destroy_function or epoch_retire().
+static void clearTable(hashmap_t *self, map_table_t table, bool retire)
+{
+    map_node_t *nodes = table.nodes;
+    uint32_t capacity = table.capacity;
+
+    for( int idx = 0; idx < capacity ; idx++)
     {
-        pthread_mutex_unlock(&self->write_lock);
-        return MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
-    }
+        if(nodes[idx].key.key_base != NULL && nodes[idx].tombstone == false)
+        {
+            map_node_t owned = ownedNode(nodes[idx]);
 
+            if (retire == true)
+                retireNode(self, nodes[idx]);
+            else if (owned.key.key_base != NULL || owned.val.val_base != NULL)
+                self->destroy_function(owned.key, owned.val);
+            self->size--;
+            #ifdef DEBUG
+                printf("clear the map[%d] (current size : %d)\n", idx, self->size);
+            #endif
+        }
+        //tombstones go too, the table starts over empty.
+        nodes[idx] = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+    }
+    if (table.ctrl != NULL)
+        memset(table.ctrl, CTRL_EMPTY, capacity);
 }
 
 bool clear_map(hashmap_t *self) {
 
-    pthread_mutex_lock(&self->write_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    else if (self->shards != NULL)
+    {
+        pthread_rwlock_rdlock(&self->lock);
+        bool success = !self->invalid;
+        pthread_rwlock_unlock(&self->lock);
+        for (int i = 0; i < self->num_shards; i++)
+            success = clear_map(&self->shards[i]) && success;
+        return success;
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || self->invalid == true)
+    if (self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
-    for( int idx = 0; idx < self->capacity ; idx++)
+    //destroy elements, lock-free readers may still hold them so they are retired.
+    seq_write_begin(self);
+    clearTable(self, currentTable(self), true);
+    if (self->old_nodes != NULL)
     {
-        //if slot is empty
-        if(self->nodes[idx].key.key_base == NULL || self->nodes[idx].tombstone == true)
-        {
-            continue;
-        }
-        else //destroy element.
-        {
-            if (self->size == 0)
-                continue;
-            pthread_mutex_lock(&self->fields_lock);
-            self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
-            self->nodes[idx].key.key_base = NULL;
-            self->nodes[idx].key.key_base = NULL;
-            self->nodes[idx].key.key_len = 0;
-            self->nodes[idx].val.val_len = 0;
-            self->nodes[idx].tombstone = false;
-            self->size--;
-            #ifdef DEBUG
-                printf("clear the map[%d] (current size : %d)\n", idx, self->size);
-            #endif
-            pthread_mutex_unlock(&self->fields_lock);
-        }
+        clearTable(self, oldTable(self), true);
+        retireArray(self, self->old_nodes, self->old_capacity, sizeof(map_node_t));
+        epoch_free(self->old_ctrl);
+        retireArray(self, self->old_inline_data, self->old_capacity, sizeof(map_inline_t));
+        self->old_nodes = NULL;
+        self->old_ctrl = NULL;
+        self->old_inline_data = NULL;
+        self->old_capacity = 0;
+        self->migrate_idx = 0;
     }
     self->size = 0; //just in case.
+    self->bytes = 0;
+    seq_write_end(self);
 
     #ifdef DEBUG
         print_map_info(self);
     #endif
 
 
-    pthread_mutex_unlock(&self->write_lock);
+    pthread_rwlock_unlock(&self->lock);
 	return true;
 }
 
 bool invalidate_map(hashmap_t *self) {
 
-    pthread_mutex_unlock(&self->write_lock);
+    if (self == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    else if (self->shards != NULL)
+    {
+        //the top level lock only guards its own flag, the shards lock themselves.
+        pthread_rwlock_wrlock(&self->lock);
+        if (self->invalid == true)
+        {
+            errno = EINVAL;
+            pthread_rwlock_unlock(&self->lock);
+            return false;
+        }
+        self->invalid = true;
+        pthread_rwlock_unlock(&self->lock);
+        for (int i = 0; i < self->num_shards; i++)
+            invalidate_map(&self->shards[i]);
+        return true;
+    }
+
+    pthread_rwlock_wrlock(&self->lock);
 
     //Error case : if any of the parameters are invalid, set errno to EINVAL.
-    if (self == NULL || self->invalid == true)
+    if (self->invalid == true)
     {
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        pthread_rwlock_unlock(&self->lock);
         return false;
     }
 
-    for( int idx = 0; idx < self->capacity ; idx++)
+    //an optimistic get() may be probing the tables right now. the odd seq sends
+    //it back to the start, where it sees invalid, and everything it could
+    //still be reading is retired rather than freed, like clear_map() does.
+    seq_write_begin(self);
+    __atomic_store_n(&self->invalid, true, __ATOMIC_RELAXED); //it sets the invalid flag in self to true.
+    clearTable(self, currentTable(self), true);
+    if (self->old_nodes != NULL)
+    {
+        clearTable(self, oldTable(self), true);
+        retireArray(self, self->old_nodes, self->old_capacity, sizeof(map_node_t));
+        epoch_free(self->old_ctrl);
+        retireArray(self, self->old_inline_data, self->old_capacity, sizeof(map_inline_t));
+        self->old_nodes = NULL;
+        self->old_ctrl = NULL;
+        self->old_inline_data = NULL;
+        self->old_capacity = 0;
+    }
+    retireArray(self, self->nodes, self->capacity, sizeof(map_node_t)); //it frees the nodes pointer in self.
+    epoch_free(self->ctrl);
+    retireArray(self, self->inline_data, self->capacity, sizeof(map_inline_t));
+    self->nodes = NULL;
+    self->ctrl = NULL;
+    self->inline_data = NULL;
+    self->bytes = 0;
+    seq_write_end(self);
+
+    pthread_rwlock_unlock(&self->lock);
+    return true;
+}
+
+//adds the probe lengths of one shard to the running totals.
+//entries still waiting in a table being migrated are left out.
+static void collectStats(hashmap_t *self, map_stats_t *stats, double *hit_sum, double *miss_sum,
+                         uint32_t *counted)
+{
+    stats->capacity += self->capacity;
+    stats->size += self->size;
+    stats->probe_alarms += __atomic_load_n(&self->probe_alarms, __ATOMIC_RELAXED);
+    stats->bytes += self->bytes;
+
+    for (int idx = 0; idx < self->capacity; idx++)
     {
-        if(self->nodes[idx].key.key_base == NULL) //if slot is empty
+        map_node_t *node = &self->nodes[idx];
+
+        if (node->tombstone == true)
+        {
+            stats->tombstones++;
+            continue;
+        }
+        else if (node->key.key_base == NULL)
         {
             continue;
         }
 
+        //a successful lookup visits every slot from the home slot to the entry,
+        //or every group from the home group in swiss table mode.
+        uint32_t dist;
+        if (self->robin_hood == true)
+            dist = node->dist;
+        else if (self->ctrl != NULL)
+            dist = (idx / GROUP_SIZE - homeGroup(node->hash, self->capacity)
+                + self->capacity / GROUP_SIZE) % (self->capacity / GROUP_SIZE);
+        else
+            dist = (idx - homeSlot(node->hash, self->capacity) + self->capacity) % self->capacity;
+        *hit_sum += dist + 1;
+        (*counted)++;
+        if (dist + 1 > stats->max_probe)
+            stats->max_probe = dist + 1;
+    }
 
-        pthread_mutex_lock(&self->fields_lock);
-        self->destroy_function(self->nodes[idx].key,self->nodes[idx].val);
-        self->nodes[idx].tombstone = false;
-        self->size--;
-        pthread_mutex_unlock(&self->fields_lock);
+    //an unsuccessful lookup starting at every home slot, with the same stop
+    //conditions as linearProbing().
+    if (self->robin_hood == true)
+    {
+        for (int home = 0; home < self->capacity; home++)
+        {
+            uint32_t visited = 0;
+            int idx = home;
+
+            while (visited < self->capacity)
+            {
+                map_node_t *node = &self->nodes[idx];
+
+                visited++;
+                if (node->key.key_base == NULL || node->dist < visited - 1)
+                    break;
+
+                idx++;
+                if (idx == self->capacity)
+                    idx = 0;
+            }
+            *miss_sum += visited;
+        }
+        return;
+    }
+    //a swiss table miss scans groups up to the first one with an empty slot,
+    //every group stands for the GROUP_SIZE home slots it holds.
+    else if (self->ctrl != NULL)
+    {
+        uint32_t num_groups = self->capacity / GROUP_SIZE;
+        for (uint32_t home = 0; home < num_groups; home++)
+        {
+            uint32_t visited = 1;
+            for (uint32_t group = home; visited < num_groups
+                && groupMatch(&self->ctrl[group * GROUP_SIZE], CTRL_EMPTY) == 0; visited++)
+                group = (group + 1 == num_groups) ? 0 : group + 1;
+            *miss_sum += (double)visited * GROUP_SIZE;
+        }
+        return;
+    }
+
+    //without robin hood a miss runs to the next never used slot, walk the table
+    //backwards from one so every slot knows its distance to it.
+    int empty = -1;
+    for (int idx = 0; idx < self->capacity && empty == -1; idx++)
+    {
+        if (self->nodes[idx].key.key_base == NULL && self->nodes[idx].tombstone == false)
+            empty = idx;
+    }
+    if (empty == -1)
+    {
+        *miss_sum += (double)self->capacity * self->capacity;
+        return;
+    }
+
+    uint32_t run = 0;
+    for (uint32_t i = 0, idx = empty; i < self->capacity; i++)
+    {
+        if (self->nodes[idx].key.key_base == NULL && self->nodes[idx].tombstone == false)
+            run = 1;
+        else
+            run++;
+        *miss_sum += run;
+        idx = (idx == 0) ? self->capacity - 1 : idx - 1;
     }
+}
 
-    pthread_mutex_lock(&self->fields_lock);
-    self->invalid = true; //it sets the invalid flag in self to true.
-    free(self->nodes); //it frees the nodes pointer in self.
-    pthread_mutex_unlock(&self->fields_lock);
+bool get_map_stats(hashmap_t *self, map_stats_t *stats) {
+
+    if (self == NULL || stats == NULL || self->invalid == true)
+    {
+        errno = EINVAL;
+        return false;
+    }
 
-    pthread_mutex_unlock(&self->write_lock);
-    return false;
+    double hit_sum = 0, miss_sum = 0;
+    uint32_t counted = 0;
+    memset(stats, 0, sizeof(map_stats_t));
+
+    for (int i = 0; i < (self->shards != NULL ? self->num_shards : 1); i++)
+    {
+        hashmap_t *shard = self->shards != NULL ? &self->shards[i] : self;
+
+        pthread_rwlock_rdlock(&shard->lock);
+        collectStats(shard, stats, &hit_sum, &miss_sum, &counted);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    stats->avg_hit_probe = counted > 0 ? hit_sum / counted : 0;
+    stats->avg_miss_probe = stats->capacity > 0 ? miss_sum / stats->capacity : 0;
+    return true;
 }
@@ -0,0 +1,104 @@
+#include "hugepage.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h> //sysconf
+
+#define PREFAULT_MAX_THREADS 64
+
+typedef struct prefault_range_t {
+    pthread_t tid;
+    bool started;
+    char *start;
+    size_t len;
+    size_t step; // bytes between two touched addresses, one per page
+} prefault_range_t;
+
+static inline size_t hugeLength(size_t len)
+{
+    return (len + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+//a write fault per page, the bytes are zero already and stay zero.
+static void *prefault(void *arg)
+{
+    prefault_range_t *range = arg;
+
+    for (size_t off = 0; off < range->len; off += range->step)
+        __atomic_store_n(&range->start[off], 0, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+//splits the array in runs of whole huge pages, the last range is faulted by the caller.
+static void prefaultParallel(char *array, size_t len, size_t step)
+{
+    prefault_range_t ranges[PREFAULT_MAX_THREADS];
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t pages = len / HUGE_PAGE_SIZE;
+    size_t threads = num_cpus < 1 ? 1 : num_cpus > PREFAULT_MAX_THREADS ? PREFAULT_MAX_THREADS : num_cpus;
+
+    if (threads > pages)
+        threads = pages;
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        size_t first = pages * i / threads, last = pages * (i + 1) / threads;
+
+        ranges[i].start = array + first * HUGE_PAGE_SIZE;
+        ranges[i].len = (last - first) * HUGE_PAGE_SIZE;
+        ranges[i].step = step;
+        //a thread that cannot be started leaves its range to the caller.
+        ranges[i].started = i + 1 < threads && pthread_create(&ranges[i].tid, NULL, prefault, &ranges[i]) == 0;
+    }
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        if (ranges[i].started == false)
+            prefault(&ranges[i]);
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        if (ranges[i].started == true)
+            pthread_join(ranges[i].tid, NULL);
+    }
+}
+
+void *huge_alloc(size_t len)
+{
+    size_t map_len = hugeLength(len);
+    char *array;
+
+    if (len == 0)
+        return NULL;
+
+    //a reserved hugetlbfs pool gives pages that are huge for sure.
+    array = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (array != MAP_FAILED)
+    {
+        prefaultParallel(array, map_len, HUGE_PAGE_SIZE);
+        return array;
+    }
+
+    //otherwise a 2 MB aligned mapping the kernel may back with transparent
+    //huge pages. the slack around the aligned part is unmapped again.
+    char *raw = mmap(NULL, map_len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    array = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (array != raw)
+        munmap(raw, array - raw);
+    munmap(array + map_len, raw + HUGE_PAGE_SIZE - array);
+
+    //without THP, or with THP disabled for it, every small page is touched.
+    madvise(array, map_len, MADV_HUGEPAGE);
+    prefaultParallel(array, map_len, sysconf(_SC_PAGESIZE));
+    return array;
+}
+
+void huge_free(void *ptr, size_t len)
+{
+    if (ptr != NULL)
+        munmap(ptr, hugeLength(len));
+}
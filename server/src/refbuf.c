@@ -0,0 +1,39 @@
+#include "refbuf.h"
+#include "slab.h"
+
+//8 bytes keep the bytes behind it as aligned as the slab chunk itself.
+typedef struct refbuf_t {
+    uint32_t refs;
+    uint32_t unused;
+    char data[];
+} refbuf_t;
+
+#define REFBUF(buf) ((refbuf_t *)((char *)(buf) - offsetof(refbuf_t, data)))
+
+void *refbuf_alloc(size_t len)
+{
+    refbuf_t *refbuf = slab_alloc(sizeof(refbuf_t) + len);
+
+    if (refbuf == NULL)
+        return NULL;
+    refbuf->refs = 1;
+    return refbuf->data;
+}
+
+void refbuf_acquire(void *buf)
+{
+    __atomic_fetch_add(&REFBUF(buf)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void refbuf_release(void *buf, size_t len)
+{
+    if (buf == NULL)
+        return;
+
+    //whatever any holder did with the bytes happens before the last one frees them.
+    if (__atomic_sub_fetch(&REFBUF(buf)->refs, 1, __ATOMIC_RELEASE) == 0)
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        slab_free(REFBUF(buf), sizeof(refbuf_t) + len);
+    }
+}
@@ -0,0 +1,241 @@
+#include "slab.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_MAX_CLASSES 64
+#define SLAB_CACHE_BATCH 16 // chunks moved between a thread cache and its class at once
+#define SLAB_CACHE_MAX 64 // free chunks a thread keeps per class before giving some back
+
+// a free chunk, the link lives in the chunk itself.
+typedef struct slab_chunk_t {
+    struct slab_chunk_t *next;
+} slab_chunk_t;
+
+typedef struct slab_class_t {
+    size_t size;
+    pthread_mutex_t lock;
+    slab_chunk_t *free_list;
+    char *page;        // current page, carved from the front
+    size_t page_left;  // bytes of the current page not handed out yet
+    slab_stats_t stats;
+} __attribute__((aligned(64))) slab_class_t;
+
+// per-thread free chunks of one class, plus the counts not yet folded into the class.
+typedef struct slab_cache_t {
+    slab_chunk_t *head;
+    uint32_t count;
+    uint64_t allocs;
+    uint64_t frees;
+} slab_cache_t;
+
+static slab_class_t classes[SLAB_MAX_CLASSES];
+static int num_classes;
+static uint8_t class_of[SLAB_MAX_SIZE / SLAB_MIN_SIZE + 1]; // indexed by size in SLAB_MIN_SIZE units
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static uint64_t large_allocs, large_frees;
+
+static pthread_key_t cache_key;
+static __thread slab_cache_t caches[SLAB_MAX_CLASSES];
+static __thread bool cache_registered;
+
+
+static void flush_caches(void *arg);
+
+static void init_classes(void)
+{
+    size_t size = SLAB_MIN_SIZE;
+
+    //memcached style classes, each one SLAB_GROWTH_FACTOR times the previous.
+    while (num_classes < SLAB_MAX_CLASSES)
+    {
+        classes[num_classes].size = size;
+        pthread_mutex_init(&classes[num_classes].lock, NULL);
+        classes[num_classes].stats.chunk_size = size;
+        num_classes++;
+        if (size == SLAB_MAX_SIZE)
+            break;
+
+        size_t next = (size_t)(size * SLAB_GROWTH_FACTOR + SLAB_MIN_SIZE - 1) / SLAB_MIN_SIZE * SLAB_MIN_SIZE;
+        size = next > size ? next : size + SLAB_MIN_SIZE;
+        if (size > SLAB_MAX_SIZE)
+            size = SLAB_MAX_SIZE;
+    }
+
+    for (int i = 0, unit = 0; unit <= SLAB_MAX_SIZE / SLAB_MIN_SIZE; unit++)
+    {
+        while (classes[i].size < (size_t)unit * SLAB_MIN_SIZE)
+            i++;
+        class_of[unit] = i;
+    }
+
+    pthread_key_create(&cache_key, flush_caches);
+}
+
+//moves up to count chunks of a thread cache back to the class.
+//must be called with the class lock held.
+static void give_back(slab_class_t *class, slab_cache_t *cache, uint32_t count)
+{
+    while (count-- > 0 && cache->head != NULL)
+    {
+        slab_chunk_t *chunk = cache->head;
+        cache->head = chunk->next;
+        cache->count--;
+        chunk->next = class->free_list;
+        class->free_list = chunk;
+        class->stats.free_chunks++;
+        class->stats.cached_chunks--;
+    }
+    class->stats.allocs += cache->allocs;
+    class->stats.frees += cache->frees;
+    cache->allocs = 0;
+    cache->frees = 0;
+}
+
+//a thread that exits hands all its cached chunks back.
+static void flush_caches(void *arg)
+{
+    for (int i = 0; i < num_classes; i++)
+    {
+        pthread_mutex_lock(&classes[i].lock);
+        give_back(&classes[i], &caches[i], caches[i].count);
+        pthread_mutex_unlock(&classes[i].lock);
+    }
+}
+
+//fills an empty thread cache from the shared free list, or from a new page.
+static bool refill(slab_class_t *class, slab_cache_t *cache)
+{
+    pthread_mutex_lock(&class->lock);
+
+    for (int n = 0; n < SLAB_CACHE_BATCH; n++)
+    {
+        slab_chunk_t *chunk;
+
+        if (class->free_list != NULL)
+        {
+            chunk = class->free_list;
+            class->free_list = chunk->next;
+            class->stats.free_chunks--;
+        }
+        else
+        {
+            if (class->page_left < class->size)
+            {
+                char *page = malloc(SLAB_PAGE_SIZE);
+                if (page == NULL)
+                    break;
+                class->page = page;
+                class->page_left = SLAB_PAGE_SIZE;
+                class->stats.pages++;
+            }
+            chunk = (slab_chunk_t *)class->page;
+            class->page += class->size;
+            class->page_left -= class->size;
+            class->stats.chunks++;
+        }
+
+        chunk->next = cache->head;
+        cache->head = chunk;
+        cache->count++;
+        class->stats.cached_chunks++;
+    }
+    class->stats.allocs += cache->allocs;
+    class->stats.frees += cache->frees;
+    cache->allocs = 0;
+    cache->frees = 0;
+
+    pthread_mutex_unlock(&class->lock);
+    return cache->head != NULL;
+}
+
+void *slab_alloc(size_t size)
+{
+    if (size > SLAB_MAX_SIZE)
+    {
+        __atomic_fetch_add(&large_allocs, 1, __ATOMIC_RELAXED);
+        return malloc(size);
+    }
+
+    pthread_once(&classes_once, init_classes);
+    if (cache_registered == false)
+    {
+        //any non NULL value makes the destructor run at thread exit.
+        pthread_setspecific(cache_key, caches);
+        cache_registered = true;
+    }
+
+    int idx = class_of[(size + SLAB_MIN_SIZE - 1) / SLAB_MIN_SIZE];
+    slab_cache_t *cache = &caches[idx];
+
+    if (cache->head == NULL && !refill(&classes[idx], cache))
+        return NULL;
+
+    slab_chunk_t *chunk = cache->head;
+    cache->head = chunk->next;
+    cache->count--;
+    cache->allocs++;
+    return chunk;
+}
+
+void slab_free(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    else if (size > SLAB_MAX_SIZE)
+    {
+        __atomic_fetch_add(&large_frees, 1, __ATOMIC_RELAXED);
+        free(ptr);
+        return;
+    }
+
+    //a chunk freed by a thread that never allocated still needs the classes.
+    pthread_once(&classes_once, init_classes);
+    if (cache_registered == false)
+    {
+        pthread_setspecific(cache_key, caches);
+        cache_registered = true;
+    }
+
+    int idx = class_of[(size + SLAB_MIN_SIZE - 1) / SLAB_MIN_SIZE];
+    slab_cache_t *cache = &caches[idx];
+    slab_chunk_t *chunk = ptr;
+
+    chunk->next = cache->head;
+    cache->head = chunk;
+    cache->count++;
+    cache->frees++;
+
+    if (cache->count > SLAB_CACHE_MAX)
+    {
+        pthread_mutex_lock(&classes[idx].lock);
+        give_back(&classes[idx], cache, SLAB_CACHE_BATCH);
+        pthread_mutex_unlock(&classes[idx].lock);
+    }
+}
+
+int slab_get_stats(slab_stats_t *stats, int num_stats)
+{
+    int filled = 0;
+
+    pthread_once(&classes_once, init_classes);
+    for (int i = 0; i < num_classes && filled < num_stats; i++)
+    {
+        pthread_mutex_lock(&classes[i].lock);
+        stats[filled++] = classes[i].stats;
+        pthread_mutex_unlock(&classes[i].lock);
+    }
+
+    if (filled < num_stats)
+    {
+        memset(&stats[filled], 0, sizeof(slab_stats_t));
+        stats[filled].allocs = __atomic_load_n(&large_allocs, __ATOMIC_RELAXED);
+        stats[filled].frees = __atomic_load_n(&large_frees, __ATOMIC_RELAXED);
+        filled++;
+    }
+    return filled;
+}
@@ -0,0 +1,227 @@
+#include "uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h> //syscall
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(SYS_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+//the completions of a ring with one issuer only run when it waits for them,
+//instead of interrupting it whenever the network has something. kernels
+//before 6.1 do not know the flags, their rings run the work right away.
+static int setupRing(unsigned entries, struct io_uring_params *params)
+{
+    int fd;
+
+    memset(params, 0, sizeof(*params));
+    params->flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    if ((fd = ioUringSetup(entries, params)) >= 0 || errno != EINVAL)
+        return fd;
+
+    memset(params, 0, sizeof(*params));
+    return ioUringSetup(entries, params);
+}
+
+static void *mapRing(int fd, size_t len, off_t offset)
+{
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+bool uring_init(uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    if ((ring->fd = setupRing(entries, &params)) < 0)
+        return false;
+    ring->flags = params.flags;
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    //both rings share one mapping since 5.4.
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_map_len > ring->sq_map_len)
+            ring->sq_map_len = ring->cq_map_len;
+        ring->cq_map_len = ring->sq_map_len;
+    }
+
+    ring->sq_map = mapRing(ring->fd, ring->sq_map_len, IORING_OFF_SQ_RING);
+    if (ring->sq_map != NULL)
+    {
+        ring->cq_map = params.features & IORING_FEAT_SINGLE_MMAP
+            ? ring->sq_map : mapRing(ring->fd, ring->cq_map_len, IORING_OFF_CQ_RING);
+    }
+    if (ring->cq_map != NULL)
+        ring->sqes = mapRing(ring->fd, ring->sqes_len, IORING_OFF_SQES);
+    if (ring->sqes == NULL)
+    {
+        int saved = errno;
+        uring_exit(ring);
+        errno = saved;
+        return false;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    //the array indirection is not needed, slot i always holds entry i.
+    for (unsigned i = 0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+    return true;
+}
+
+void uring_exit(uring_t *ring)
+{
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map != NULL)
+        munmap(ring->sq_map, ring->sq_map_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+//the kernel only reads the queue inside io_uring_enter(), so an entry can be
+//published before the caller fills it in.
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    unsigned tail = *ring->sq_tail;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (uring_submit_and_wait(ring, 0) <= 0)
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr)
+{
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = 0;
+
+    //a deferred ring only runs its completions when asked for events.
+    if (wait_nr > 0 || (ring->flags & IORING_SETUP_DEFER_TASKRUN))
+        flags |= IORING_ENTER_GETEVENTS;
+    return ioUringEnter(ring->fd, to_submit, wait_nr, flags);
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_setup_buffers(uring_t *ring, uring_buffers_t *buffers, unsigned short group,
+    unsigned entries, size_t buf_size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (entries == 0 || entries > 32768 || (entries & (entries - 1)) != 0 || buf_size == 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    //the kernel wants the ring itself page aligned.
+    memset(buffers, 0, sizeof(*buffers));
+    buffers->ring_len = (entries * sizeof(struct io_uring_buf) + page_size - 1) & ~(size_t)(page_size - 1);
+    buffers->ring = mmap(NULL, buffers->ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED)
+    {
+        buffers->ring = NULL;
+        return false;
+    }
+    buffers->bufs = mmap(NULL, entries * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->bufs == MAP_FAILED)
+    {
+        munmap(buffers->ring, buffers->ring_len);
+        buffers->ring = NULL;
+        buffers->bufs = NULL;
+        return false;
+    }
+    buffers->entries = entries;
+    buffers->buf_size = buf_size;
+    buffers->group = group;
+
+    struct io_uring_buf_reg reg = {.ring_addr = (unsigned long)buffers->ring, .ring_entries = entries, .bgid = group};
+    if (ioUringRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int saved = errno;
+        munmap(buffers->bufs, entries * buf_size);
+        munmap(buffers->ring, buffers->ring_len);
+        memset(buffers, 0, sizeof(*buffers));
+        errno = saved;
+        return false;
+    }
+
+    for (unsigned bid = 0; bid < entries; bid++)
+        uring_recycle_buffer(buffers, bid);
+    return true;
+}
+
+void uring_free_buffers(uring_t *ring, uring_buffers_t *buffers)
+{
+    struct io_uring_buf_reg reg = {.bgid = buffers->group};
+
+    if (buffers->ring == NULL)
+        return;
+    ioUringRegister(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(buffers->bufs, buffers->entries * buffers->buf_size);
+    munmap(buffers->ring, buffers->ring_len);
+    memset(buffers, 0, sizeof(*buffers));
+}
+
+//the tail shares its bytes with the first buffer's reserved field, it is
+//only written by the owner of the ring.
+void uring_recycle_buffer(uring_buffers_t *buffers, unsigned bid)
+{
+    unsigned short tail = buffers->ring->tail;
+    struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+
+    buf->addr = (unsigned long)uring_buffer(buffers, bid);
+    buf->len = buffers->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&buffers->ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
@@ -31,5 +31,17 @@ uint32_t jenkins_one_at_a_time_hash(map_key_t map_key) {
  * in the self parameter.
  */
 int get_index(hashmap_t *self, map_key_t key) {
-    return self->hash_function(key) % self->capacity;
+    uint32_t hash = self->hash_function(key);
+
+    //a power of two capacity is masked, which avoids the integer division.
+    return (self->capacity & (self->capacity - 1)) == 0 ? hash & (self->capacity - 1) : hash % self->capacity;
+}
+
+/*
+ * Gets the shard responsible for a key in a sharded map.
+ * The high bits of the hash pick the shard so that they stay independent of
+ * the low bits get_index() uses inside the shard.
+ */
+hashmap_t *get_shard(hashmap_t *self, map_key_t key) {
+    return &self->shards[((uint64_t)self->hash_function(key) * self->num_shards) >> 32];
 }
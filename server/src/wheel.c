@@ -0,0 +1,134 @@
+#include "wheel.h"
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WHEEL_SPAN(level) ((uint64_t)1 << (WHEEL_BITS * (level))) // ticks covered by one slot of level
+#define WHEEL_PLACE_BATCH 64 // entries wheel_advance() places again per hold of the lock
+
+uint64_t wheel_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+wheel_t *wheel_create(void)
+{
+    wheel_t *wheel = calloc(1, sizeof(wheel_t));
+
+    if (wheel == NULL)
+        return NULL;
+    pthread_mutex_init(&wheel->lock, NULL);
+    wheel->current = wheel_now_ms() / WHEEL_TICK_MS;
+    return wheel;
+}
+
+//puts an entry into the lowest level whose range reaches its tick. the slot
+//is picked by the tick itself, so it comes up exactly when the time gets
+//there. deadlines beyond the last level wait in it and are placed again.
+//must be called with the wheel lock held.
+static void place(wheel_t *wheel, wheel_entry_t *entry)
+{
+    uint64_t delta = entry->expires > wheel->current ? entry->expires - wheel->current : 0;
+    uint64_t expires = entry->expires;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level + 1))
+        level++;
+    if (delta >= WHEEL_SPAN(WHEEL_LEVELS))
+        expires = wheel->current + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+
+    wheel_entry_t **slot = &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    entry->next = *slot;
+    *slot = entry;
+}
+
+bool wheel_add(wheel_t *wheel, const void *key, size_t key_len, uint32_t ttl_ms)
+{
+    wheel_entry_t *entry = slab_alloc(sizeof(wheel_entry_t) + key_len);
+
+    if (entry == NULL)
+        return false;
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    entry->expires = (wheel_now_ms() + ttl_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+
+    pthread_mutex_lock(&wheel->lock);
+    //the slot of the current tick has been collected already.
+    if (entry->expires <= wheel->current)
+        entry->expires = wheel->current + 1;
+    place(wheel, entry);
+    pthread_mutex_unlock(&wheel->lock);
+    return true;
+}
+
+//hands a detached slot's entries on: the due ones to the caller, the others
+//back into the wheel, WHEEL_PLACE_BATCH per hold of the lock so a PUT never
+//waits for a whole cascade. tick is the time the slot was detached at.
+static void sortOut(wheel_t *wheel, wheel_entry_t *entry, uint64_t tick, wheel_entry_t **due)
+{
+    int placed = 0;
+
+    while (entry != NULL)
+    {
+        wheel_entry_t *next = entry->next;
+
+        if (entry->expires <= tick)
+        {
+            entry->next = *due;
+            *due = entry;
+        }
+        else
+        {
+            if (placed % WHEEL_PLACE_BATCH == 0)
+                pthread_mutex_lock(&wheel->lock);
+            place(wheel, entry);
+            if (++placed % WHEEL_PLACE_BATCH == 0)
+                pthread_mutex_unlock(&wheel->lock);
+        }
+        entry = next;
+    }
+    if (placed % WHEEL_PLACE_BATCH != 0)
+        pthread_mutex_unlock(&wheel->lock);
+}
+
+//the lock is only held to move the clock and detach the slots of each tick,
+//their entries are sorted out after it is released. only the one thread that
+//advances the wheel changes current, so it stays put meanwhile.
+wheel_entry_t *wheel_advance(wheel_t *wheel, uint64_t now_ms)
+{
+    wheel_entry_t *due = NULL;
+
+    pthread_mutex_lock(&wheel->lock);
+    while (wheel->current < now_ms / WHEEL_TICK_MS)
+    {
+        wheel_entry_t *lists[WHEEL_LEVELS] = {NULL};
+        uint64_t tick = ++wheel->current;
+
+        //every level whose lower levels just wrapped around spreads its
+        //current slot over the levels below, level 0 hands its slot in.
+        lists[0] = wheel->slots[0][tick & (WHEEL_SLOTS - 1)];
+        wheel->slots[0][tick & (WHEEL_SLOTS - 1)] = NULL;
+        for (int level = 1; level < WHEEL_LEVELS && (tick & (WHEEL_SPAN(level) - 1)) == 0; level++)
+        {
+            wheel_entry_t **slot = &wheel->slots[level][(tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+            lists[level] = *slot;
+            *slot = NULL;
+        }
+        pthread_mutex_unlock(&wheel->lock);
+
+        for (int level = 0; level < WHEEL_LEVELS; level++)
+            sortOut(wheel, lists[level], tick, &due);
+        pthread_mutex_lock(&wheel->lock);
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return due;
+}
+
+void wheel_free_entry(wheel_entry_t *entry)
+{
+    slab_free(entry, sizeof(wheel_entry_t) + entry->key_len);
+}